@@ -9,6 +9,8 @@
     'ngn_use_custom_boost_root%': 'false',
     'ngn_custom_boost_root%': 'deps/boost',
     'ngn_enable_il8n_support%': 'false',
+    # io_uring file I/O on linux, falls back to the threadpool at runtime
+    'ngn_use_io_uring%': 'false',
     'icu_gyp_path%': 'deps/icu/icu.gyp',
     'os_posix%': 1
   },
@@ -30,31 +32,53 @@
         'deps/uv/src/ares'
       ],
      'sources': [
+        'src/ascii.cpp',
+        'src/base64.cpp',
         'src/buffer.cpp',
         'src/buffer_decoder.cpp',
+        'src/buffer_pool.cpp',
+        'src/buffer_queue.cpp',
+        'src/cpu_features.cpp',
+        'src/directory_walker.cpp',
         'src/encoding.cpp',
         'src/eventloop.cpp',
+        'src/executor.cpp',
+        'src/file_stream.cpp',
         'src/filesystem.cpp',
       #  'src/folly/io/IOBuf.cpp',
         'src/handle.cpp',
+        'src/hex.cpp',
         'src/io_buffer.cpp',
+        'src/isolate.cpp',
+        'src/isolate_pool.cpp',
         'src/main.cpp',
         'src/stream.cpp',
         'src/string_bytes.cpp',
+        'src/timer_wheel.cpp',
         'src/unicode_string.cpp',
+        'src/uring.cpp',
+        'src/utf8.cpp',
         'src/utils.cpp',
         'src/wrapper.cpp',
 
         # headers for IDE
         'src/any-standalone.h',
         'src/any.h',
+        'src/ascii.h',
+        'src/base64.h',
         'src/buffer.h',
         'src/buffer_decoder.h',
+        'src/buffer_pool.h',
+        'src/buffer_queue.h',
         'src/boost/config.hpp',
+        'src/cpu_features.h',
+        'src/directory_walker.h',
         'src/encoding.h',
         'src/event.h',
         'src/eventloop.h',
         'src/exceptions.h',
+        'src/executor.h',
+        'src/file_stream.h',
         'src/filesystem.h',
         'src/folly/config.h',
         'src/folly/detail/UncaughtExceptionCounter.h',
@@ -64,15 +88,24 @@
         'src/folly/Preprocessor.h',
         'src/folly/ScopeGuard.h',
         'src/handle.h',
+        'src/hex.h',
+        'src/inplace_function.h',
         'src/io_buffer.h',
+        'src/isolate.h',
+        'src/isolate_pool.h',
+        'src/mpsc_queue.h',
         'src/ngn.h',
         'src/optional-standalone.h',
         'src/optional.h',
         'src/pointer_iterator.h',
+        'src/small_task.h',
         'src/stream.h',
         'src/string_bytes.h',
+        'src/timer_wheel.h',
         'src/traits.h',
         'src/unicode_string.h',
+        'src/uring.h',
+        'src/utf8.h',
         'src/utils.h',
         'src/wrapper.h'
         ],
@@ -98,6 +131,9 @@
         ['ngn_use_boost=="false"', {
           'sources': ['src/any-standalone.h']
         }],
+        ['OS=="linux" and ngn_use_io_uring=="true"', {
+          'defines': ['NGN_USE_IO_URING']
+        }],
         ['OS=="linux"', {
           'defines': [
           ],
@@ -0,0 +1,361 @@
+// Copyright Joyent, Inc. and other Node contributors.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit
+// persons to whom the Software is furnished to do so, subject to the
+// following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+// NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+// USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ascii.h"
+#include "cpu_features.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(NGN_HAVE_X86_DISPATCH)
+#include <immintrin.h>
+#elif defined(NGN_HAVE_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace ngn {
+    static bool contains_non_ascii_slow(const char* buf, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            if (buf[i] & 0x80)
+                return true;
+        }
+        return false;
+    }
+    
+    
+    static bool contains_non_ascii_word(const char* src, size_t len) {
+        if (len < 16) {
+            return contains_non_ascii_slow(src, len);
+        }
+        
+        const unsigned bytes_per_word = sizeof(uintptr_t);
+        const unsigned align_mask = bytes_per_word - 1;
+        const unsigned unaligned = reinterpret_cast<uintptr_t>(src) & align_mask;
+        
+        if (unaligned > 0) {
+            const unsigned n = bytes_per_word - unaligned;
+            if (contains_non_ascii_slow(src, n))
+                return true;
+            src += n;
+            len -= n;
+        }
+        
+        
+#if defined(__x86_64__) || defined(_WIN64)
+        const uintptr_t mask = 0x8080808080808080ll;
+#else
+        const uintptr_t mask = 0x80808080l;
+#endif
+        
+        const uintptr_t* srcw = reinterpret_cast<const uintptr_t*>(src);
+        
+        for (size_t i = 0, n = len / bytes_per_word; i < n; ++i) {
+            if (srcw[i] & mask)
+                return true;
+        }
+        
+        const unsigned remainder = len & align_mask;
+        if (remainder > 0) {
+            const size_t offset = len - remainder;
+            if (contains_non_ascii_slow(src + offset, remainder))
+                return true;
+        }
+        
+        return false;
+    }
+    
+    
+    static void force_ascii_slow(const char* src, char* dst, size_t len) {
+        for (size_t i = 0; i < len; ++i) {
+            dst[i] = src[i] & 0x7f;
+        }
+    }
+    
+    
+    static void force_ascii_word(const char* src, char* dst, size_t len) {
+        if (len < 16) {
+            force_ascii_slow(src, dst, len);
+            return;
+        }
+        
+        const unsigned bytes_per_word = sizeof(uintptr_t);
+        const unsigned align_mask = bytes_per_word - 1;
+        const unsigned src_unalign = reinterpret_cast<uintptr_t>(src) & align_mask;
+        const unsigned dst_unalign = reinterpret_cast<uintptr_t>(dst) & align_mask;
+        
+        if (src_unalign != dst_unalign) {
+            force_ascii_slow(src, dst, len);
+            return;
+        }
+        
+        if (src_unalign > 0) {
+            const unsigned unalign = bytes_per_word - src_unalign;
+            force_ascii_slow(src, dst, unalign);
+            src += unalign;
+            dst += unalign;
+            len -= unalign;
+        }
+        
+#if defined(__x86_64__) || defined(_WIN64)
+        const uintptr_t mask = ~0x8080808080808080ll;
+#else
+        const uintptr_t mask = ~0x80808080l;
+#endif
+        
+        const uintptr_t* srcw = reinterpret_cast<const uintptr_t*>(src);
+        uintptr_t* dstw = reinterpret_cast<uintptr_t*>(dst);
+        
+        for (size_t i = 0, n = len / bytes_per_word; i < n; ++i) {
+            dstw[i] = srcw[i] & mask;
+        }
+        
+        const unsigned remainder = len & align_mask;
+        if (remainder > 0) {
+            const size_t offset = len - remainder;
+            force_ascii_slow(src + offset, dst + offset, remainder);
+        }
+    }
+    
+    
+    static size_t find_non_ascii_word(const char* src, size_t len) {
+        const char* begin = src;
+        const char* end = src + len;
+        
+        for (; end - src >= 8; src += 8) {
+            uint64_t word;
+            memcpy(&word, src, sizeof(word));
+            if (word & 0x8080808080808080ull)
+                break;
+        }
+        for (; src != end; ++src) {
+            if (*src & 0x80)
+                break;
+        }
+        return src - begin;
+    }
+    
+    
+    static line_break_count count_line_breaks_slow(const char* src, size_t len) {
+        line_break_count count;
+        for (size_t i = 0; i < len; ++i) {
+            count.lf += src[i] == '\n';
+            count.cr += src[i] == '\r';
+        }
+        return count;
+    }
+    
+    
+#if defined(NGN_HAVE_X86_DISPATCH)
+    //
+    // AVX2
+    //
+    
+    NGN_TARGET("avx2")
+    static bool contains_non_ascii_avx2(const char* src, size_t len) {
+        size_t i = 0;
+        for (; i + 128 <= len; i += 128) {
+            const __m256i* p = reinterpret_cast<const __m256i*>(src + i);
+            const __m256i any = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p + 1)),
+                                                _mm256_or_si256(_mm256_loadu_si256(p + 2), _mm256_loadu_si256(p + 3)));
+            if (_mm256_movemask_epi8(any))
+                return true;
+        }
+        for (; i + 32 <= len; i += 32) {
+            if (_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i))))
+                return true;
+        }
+        return contains_non_ascii_slow(src + i, len - i);
+    }
+    
+    
+    NGN_TARGET("avx2")
+    static size_t find_non_ascii_avx2(const char* src, size_t len) {
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            const int mask = _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return i + find_non_ascii_word(src + i, len - i);
+    }
+    
+    
+    NGN_TARGET("avx2")
+    static void force_ascii_avx2(const char* src, char* dst, size_t len) {
+        const __m256i mask = _mm256_set1_epi8(0x7f);
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_and_si256(in, mask));
+        }
+        force_ascii_slow(src + i, dst + i, len - i);
+    }
+    
+    
+    NGN_TARGET("avx2")
+    static line_break_count count_line_breaks_avx2(const char* src, size_t len) {
+        const __m256i lf = _mm256_set1_epi8('\n');
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i zero = _mm256_setzero_si256();
+        line_break_count count;
+        size_t i = 0;
+        
+        while (i + 32 <= len) {
+            // per byte counters, folded into 64 bit lanes before they can wrap
+            __m256i lf_bytes = zero;
+            __m256i cr_bytes = zero;
+            for (unsigned n = 0; n < 255 && i + 32 <= len; ++n, i += 32) {
+                const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+                lf_bytes = _mm256_sub_epi8(lf_bytes, _mm256_cmpeq_epi8(in, lf));
+                cr_bytes = _mm256_sub_epi8(cr_bytes, _mm256_cmpeq_epi8(in, cr));
+            }
+            const __m256i lf_sum = _mm256_sad_epu8(lf_bytes, zero);
+            const __m256i cr_sum = _mm256_sad_epu8(cr_bytes, zero);
+            count.lf += _mm256_extract_epi64(lf_sum, 0) + _mm256_extract_epi64(lf_sum, 1) +
+                        _mm256_extract_epi64(lf_sum, 2) + _mm256_extract_epi64(lf_sum, 3);
+            count.cr += _mm256_extract_epi64(cr_sum, 0) + _mm256_extract_epi64(cr_sum, 1) +
+                        _mm256_extract_epi64(cr_sum, 2) + _mm256_extract_epi64(cr_sum, 3);
+        }
+        
+        const line_break_count tail = count_line_breaks_slow(src + i, len - i);
+        count.lf += tail.lf;
+        count.cr += tail.cr;
+        return count;
+    }
+#endif
+    
+    
+#if defined(NGN_HAVE_NEON)
+    //
+    // NEON
+    //
+    
+    static bool contains_non_ascii_neon(const char* src, size_t len) {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            const uint8x16_t any = vorrq_u8(vld1q_u8(s + i), vld1q_u8(s + i + 16));
+            if (vmaxvq_u8(any) & 0x80)
+                return true;
+        }
+        return contains_non_ascii_slow(src + i, len - i);
+    }
+    
+    
+    static size_t find_non_ascii_neon(const char* src, size_t len) {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            const uint8x16_t any = vorrq_u8(vld1q_u8(s + i), vld1q_u8(s + i + 16));
+            if (vmaxvq_u8(any) & 0x80)
+                break;
+        }
+        return i + find_non_ascii_word(src + i, len - i);
+    }
+    
+    
+    static void force_ascii_neon(const char* src, char* dst, size_t len) {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+        uint8_t* d = reinterpret_cast<uint8_t*>(dst);
+        const uint8x16_t mask = vdupq_n_u8(0x7f);
+        size_t i = 0;
+        for (; i + 32 <= len; i += 32) {
+            vst1q_u8(d + i, vandq_u8(vld1q_u8(s + i), mask));
+            vst1q_u8(d + i + 16, vandq_u8(vld1q_u8(s + i + 16), mask));
+        }
+        force_ascii_slow(src + i, dst + i, len - i);
+    }
+    
+    
+    static line_break_count count_line_breaks_neon(const char* src, size_t len) {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+        const uint8x16_t lf = vdupq_n_u8('\n');
+        const uint8x16_t cr = vdupq_n_u8('\r');
+        line_break_count count;
+        size_t i = 0;
+        
+        while (i + 32 <= len) {
+            uint8x16_t lf_bytes = vdupq_n_u8(0);
+            uint8x16_t cr_bytes = vdupq_n_u8(0);
+            // two matches per lane per iteration, fold before they wrap
+            for (unsigned n = 0; n < 127 && i + 32 <= len; ++n, i += 32) {
+                const uint8x16_t a = vld1q_u8(s + i);
+                const uint8x16_t b = vld1q_u8(s + i + 16);
+                lf_bytes = vsubq_u8(vsubq_u8(lf_bytes, vceqq_u8(a, lf)), vceqq_u8(b, lf));
+                cr_bytes = vsubq_u8(vsubq_u8(cr_bytes, vceqq_u8(a, cr)), vceqq_u8(b, cr));
+            }
+            count.lf += vaddlvq_u8(lf_bytes);
+            count.cr += vaddlvq_u8(cr_bytes);
+        }
+        
+        const line_break_count tail = count_line_breaks_slow(src + i, len - i);
+        count.lf += tail.lf;
+        count.cr += tail.cr;
+        return count;
+    }
+#endif
+    
+    
+    namespace {
+        struct ascii_kernel {
+            bool (*contains_non_ascii)(const char*, size_t);
+            size_t (*find_non_ascii)(const char*, size_t);
+            void (*force_ascii)(const char*, char*, size_t);
+            line_break_count (*count_line_breaks)(const char*, size_t);
+        };
+        
+        ascii_kernel select_kernel() noexcept {
+#if defined(NGN_HAVE_X86_DISPATCH)
+            if (cpu::detect().avx2)
+                return {contains_non_ascii_avx2, find_non_ascii_avx2, force_ascii_avx2, count_line_breaks_avx2};
+#elif defined(NGN_HAVE_NEON)
+            if (cpu::detect().neon)
+                return {contains_non_ascii_neon, find_non_ascii_neon, force_ascii_neon, count_line_breaks_neon};
+#endif
+            return {contains_non_ascii_word, find_non_ascii_word, force_ascii_word, count_line_breaks_slow};
+        }
+        
+        const ascii_kernel& kernel() noexcept {
+            static const ascii_kernel selected = select_kernel();
+            return selected;
+        }
+    }
+    
+    
+    bool contains_non_ascii(const char* src, size_t len) {
+        return kernel().contains_non_ascii(src, len);
+    };
+    
+    
+    size_t find_non_ascii(const char* src, size_t len) {
+        return kernel().find_non_ascii(src, len);
+    };
+    
+    
+    void force_ascii(const char* src, char* dst, size_t len) {
+        kernel().force_ascii(src, dst, len);
+    };
+    
+    
+    line_break_count count_line_breaks(const char* src, size_t len) {
+        return kernel().count_line_breaks(src, len);
+    };
+}
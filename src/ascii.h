@@ -0,0 +1,36 @@
+//
+//  ascii.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__ascii__
+#define __ngn__ascii__
+
+#include <cstddef>
+
+namespace ngn {
+    // Byte classification over text chunks. Every function has a 32 byte
+    // vector path (AVX2 or NEON) picked once on first use, with a word at a
+    // time fallback.
+    
+    // true if any byte has the high bit set
+    bool contains_non_ascii(const char* src, size_t len);
+    
+    // offset of the first byte >= 0x80, len if there is none
+    size_t find_non_ascii(const char* src, size_t len);
+    
+    // copies src to dst with the high bit of every byte cleared
+    void force_ascii(const char* src, char* dst, size_t len);
+    
+    struct line_break_count {
+        size_t lf = 0;
+        size_t cr = 0;
+    };
+    
+    // number of '\n' and '\r' bytes, for sizing line splits up front
+    line_break_count count_line_breaks(const char* src, size_t len);
+}
+
+#endif /* defined(__ngn__ascii__) */
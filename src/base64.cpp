@@ -0,0 +1,518 @@
+//
+//  base64.cpp
+//  ngn
+//
+//
+//
+
+#include "base64.h"
+#include "cpu_features.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+
+#if defined(NGN_HAVE_X86_DISPATCH)
+#include <immintrin.h>
+#endif
+
+namespace ngn {
+    namespace {
+        // supports regular and URL-safe base64
+        const int8_t unbase64_table[] =
+        {   -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, 62, -1, 63,
+            52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+            -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+            15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+            -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+            41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+        };
+#define unbase64(x) unbase64_table[(uint8_t)(x)]
+
+        const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                    "abcdefghijklmnopqrstuvwxyz"
+                                    "0123456789+/";
+
+        const char base64url_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                       "abcdefghijklmnopqrstuvwxyz"
+                                       "0123456789-_";
+
+        // A kernel converts as many whole blocks as it can and advances the
+        // pointers past them; the scalar code finishes whatever is left.
+        // The decoder stops at the first block holding a character outside
+        // of the alphabet so the scalar path can deal with it.
+        struct base64_kernel {
+            void (*encode)(const uint8_t*& src, const uint8_t* src_end, char*& dst, bool url_safe);
+            void (*decode)(const char*& src, const char* src_end, uint8_t*& dst, uint8_t* dst_end);
+        };
+
+        //
+        // Scalar
+        //
+
+        void encode_scalar(const uint8_t*&, const uint8_t*, char*&, bool) {}
+        void decode_scalar(const char*&, const char*, uint8_t*&, uint8_t*) {}
+
+        // Decodes the next group of 4 characters, skipping anything outside
+        // of the alphabet. Returns false once the input is exhausted, hits a
+        // '=' or the output is full
+        bool decode_group(const char*& src, const char* src_end, uint8_t*& dst, uint8_t* dst_end) {
+            uint8_t v[4];
+            unsigned n = 0;
+            bool terminated = false;
+
+            while (n < 4 && src < src_end) {
+                const char c = *src++;
+                const int8_t value = unbase64(c);
+                if (value >= 0) {
+                    v[n++] = value;
+                } else if (c == '=') {
+                    terminated = true;
+                    break;
+                }
+            }
+
+            if (n < 2)
+                return false;
+
+            *dst++ = (v[0] << 2) | ((v[1] & 0x30) >> 4);
+            if (n == 2 || dst == dst_end)
+                return false;
+
+            *dst++ = ((v[1] & 0x0F) << 4) | ((v[2] & 0x3C) >> 2);
+            if (n == 3 || dst == dst_end)
+                return false;
+
+            *dst++ = ((v[2] & 0x03) << 6) | (v[3] & 0x3F);
+            return !terminated && dst != dst_end;
+        }
+
+#if defined(NGN_HAVE_X86_DISPATCH)
+        //
+        // SSE4.1
+        //
+
+        // 12 bytes in the low part of each 16 byte lane -> 16 sextets,
+        // one per byte (Muła's multiply-shift)
+        NGN_TARGET("sse4.1")
+        inline __m128i encode_split(__m128i in) {
+            in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+            const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+            const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+            const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+            const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+            return _mm_or_si128(t1, t3);
+        }
+
+        // sextets -> ascii: reduce every sextet to a range id, then add the
+        // offset of that range looked up with pshufb
+        NGN_TARGET("sse4.1")
+        inline __m128i encode_translate(__m128i sextets, __m128i shift_lut) {
+            __m128i range = _mm_subs_epu8(sextets, _mm_set1_epi8(51));
+            const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), sextets);
+            range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+            return _mm_add_epi8(_mm_shuffle_epi8(shift_lut, range), sextets);
+        }
+
+        NGN_TARGET("sse4.1")
+        inline __m128i encode_shift_lut(bool url_safe) {
+            const char c62 = url_safe ? '-' : '+';
+            const char c63 = url_safe ? '_' : '/';
+            return _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                 '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                 c62 - 62, c63 - 63, 'A', 0, 0);
+        }
+
+        // ascii -> sextets, both alphabets. returns false if any byte isn't
+        // part of either
+        NGN_TARGET("sse4.1")
+        inline bool decode_translate(__m128i in, __m128i& out) {
+            const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('A' - 1)),
+                                                _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), in));
+            const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('a' - 1)),
+                                                _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), in));
+            const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+                                                _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), in));
+            const __m128i c62 = _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('+')),
+                                             _mm_cmpeq_epi8(in, _mm_set1_epi8('-')));
+            const __m128i c63 = _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')),
+                                             _mm_cmpeq_epi8(in, _mm_set1_epi8('_')));
+
+            const __m128i ranges = _mm_or_si128(_mm_or_si128(upper, lower), digit);
+            const __m128i valid = _mm_or_si128(ranges, _mm_or_si128(c62, c63));
+            if (_mm_movemask_epi8(valid) != 0xFFFF)
+                return false;
+
+            __m128i offset = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+            offset = _mm_or_si128(offset, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+            offset = _mm_or_si128(offset, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+
+            out = _mm_and_si128(ranges, _mm_add_epi8(in, offset));
+            out = _mm_or_si128(out, _mm_and_si128(c62, _mm_set1_epi8(62)));
+            out = _mm_or_si128(out, _mm_and_si128(c63, _mm_set1_epi8(63)));
+            return true;
+        }
+
+        // 16 sextets -> 12 bytes in the low part of each lane
+        NGN_TARGET("sse4.1")
+        inline __m128i decode_pack(__m128i sextets) {
+            const __m128i pairs = _mm_maddubs_epi16(sextets, _mm_set1_epi32(0x01400140));
+            const __m128i triples = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+            return _mm_shuffle_epi8(triples, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        }
+
+        NGN_TARGET("sse4.1")
+        void encode_sse41(const uint8_t*& src, const uint8_t* src_end, char*& dst, bool url_safe) {
+            const __m128i shift_lut = encode_shift_lut(url_safe);
+
+            // loads 16 bytes, consumes 12
+            while (src_end - src >= 16) {
+                const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), encode_translate(encode_split(in), shift_lut));
+                src += 12;
+                dst += 16;
+            }
+        }
+
+        NGN_TARGET("sse4.1")
+        void decode_sse41(const char*& src, const char* src_end, uint8_t*& dst, uint8_t* dst_end) {
+            // stores 16 bytes, produces 12
+            while (src_end - src >= 16 && dst_end - dst >= 16) {
+                __m128i sextets;
+                if (!decode_translate(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), sextets))
+                    return;
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), decode_pack(sextets));
+                src += 16;
+                dst += 12;
+            }
+        }
+
+        //
+        // AVX2
+        //
+
+        NGN_TARGET("avx2")
+        inline __m256i encode_split(__m256i in) {
+            in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                                          1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+            const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+            const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+            const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+            const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+            return _mm256_or_si256(t1, t3);
+        }
+
+        NGN_TARGET("avx2")
+        inline __m256i encode_translate(__m256i sextets, __m256i shift_lut) {
+            __m256i range = _mm256_subs_epu8(sextets, _mm256_set1_epi8(51));
+            const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), sextets);
+            range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+            return _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, range), sextets);
+        }
+
+        NGN_TARGET("avx2")
+        inline bool decode_translate(__m256i in, __m256i& out) {
+            const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('A' - 1)),
+                                                   _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), in));
+            const __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('a' - 1)),
+                                                   _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), in));
+            const __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(in, _mm256_set1_epi8('0' - 1)),
+                                                   _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), in));
+            const __m256i c62 = _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('+')),
+                                                _mm256_cmpeq_epi8(in, _mm256_set1_epi8('-')));
+            const __m256i c63 = _mm256_or_si256(_mm256_cmpeq_epi8(in, _mm256_set1_epi8('/')),
+                                                _mm256_cmpeq_epi8(in, _mm256_set1_epi8('_')));
+
+            const __m256i ranges = _mm256_or_si256(_mm256_or_si256(upper, lower), digit);
+            const __m256i valid = _mm256_or_si256(ranges, _mm256_or_si256(c62, c63));
+            if (_mm256_movemask_epi8(valid) != -1)
+                return false;
+
+            __m256i offset = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+            offset = _mm256_or_si256(offset, _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a')));
+            offset = _mm256_or_si256(offset, _mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')));
+
+            out = _mm256_and_si256(ranges, _mm256_add_epi8(in, offset));
+            out = _mm256_or_si256(out, _mm256_and_si256(c62, _mm256_set1_epi8(62)));
+            out = _mm256_or_si256(out, _mm256_and_si256(c63, _mm256_set1_epi8(63)));
+            return true;
+        }
+
+        // 32 sextets -> 24 contiguous bytes
+        NGN_TARGET("avx2")
+        inline __m256i decode_pack(__m256i sextets) {
+            const __m256i pairs = _mm256_maddubs_epi16(sextets, _mm256_set1_epi32(0x01400140));
+            const __m256i triples = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+            const __m256i packed = _mm256_shuffle_epi8(triples, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                                                 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+            return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+        }
+
+        NGN_TARGET("avx2")
+        void encode_avx2(const uint8_t*& src, const uint8_t* src_end, char*& dst, bool url_safe) {
+            const __m128i lut = encode_shift_lut(url_safe);
+            const __m256i shift_lut = _mm256_inserti128_si256(_mm256_castsi128_si256(lut), lut, 1);
+
+            // two overlapping 16 byte loads, consumes 24
+            while (src_end - src >= 28) {
+                const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+                const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12));
+                const __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), encode_translate(encode_split(in), shift_lut));
+                src += 24;
+                dst += 32;
+            }
+            encode_sse41(src, src_end, dst, url_safe);
+        }
+
+        NGN_TARGET("avx2")
+        void decode_avx2(const char*& src, const char* src_end, uint8_t*& dst, uint8_t* dst_end) {
+            // stores 32 bytes, produces 24
+            while (src_end - src >= 32 && dst_end - dst >= 32) {
+                __m256i sextets;
+                if (!decode_translate(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)), sextets))
+                    break;
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), decode_pack(sextets));
+                src += 32;
+                dst += 24;
+            }
+            // the tail, or the clean half of a block that failed
+            decode_sse41(src, src_end, dst, dst_end);
+        }
+#endif
+
+        base64_kernel select_kernel() noexcept {
+#if defined(NGN_HAVE_X86_DISPATCH)
+            const cpu::features& cpu = cpu::detect();
+            if (cpu.avx2)
+                return {encode_avx2, decode_avx2};
+            if (cpu.sse41)
+                return {encode_sse41, decode_sse41};
+#endif
+            return {encode_scalar, decode_scalar};
+        }
+
+        // picked on first use so callers from static initializers are safe
+        const base64_kernel& kernel() noexcept {
+            static const base64_kernel selected = select_kernel();
+            return selected;
+        }
+    }
+
+
+    int base64_value(char c) noexcept {
+        return unbase64(c);
+    };
+
+
+    size_t base64_encode(const char* src,
+                         size_t slen,
+                         char* dst,
+                         size_t dlen,
+                         bool url_safe) {
+        // We know how much we'll write, just make sure that there's space.
+        assert(dlen >= base64_encoded_size(slen) &&
+               "not enough space provided for base64 encode");
+
+        dlen = base64_encoded_size(slen);
+
+        const char* table = url_safe ? base64url_table : base64_table;
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* in_end = in + slen;
+
+        kernel().encode(in, in_end, dst, url_safe);
+
+        unsigned a;
+        unsigned b;
+        unsigned c;
+
+        while (in_end - in >= 3) {
+            a = in[0];
+            b = in[1];
+            c = in[2];
+
+            dst[0] = table[a >> 2];
+            dst[1] = table[((a & 3) << 4) | (b >> 4)];
+            dst[2] = table[((b & 0x0f) << 2) | (c >> 6)];
+            dst[3] = table[c & 0x3f];
+
+            in += 3;
+            dst += 4;
+        }
+
+        switch (in_end - in) {
+            case 1:
+                a = in[0];
+                dst[0] = table[a >> 2];
+                dst[1] = table[(a & 3) << 4];
+                dst[2] = '=';
+                dst[3] = '=';
+                break;
+
+            case 2:
+                a = in[0];
+                b = in[1];
+                dst[0] = table[a >> 2];
+                dst[1] = table[((a & 3) << 4) | (b >> 4)];
+                dst[2] = table[(b & 0x0f) << 2];
+                dst[3] = '=';
+                break;
+        }
+
+        return dlen;
+    };
+
+
+    size_t base64_decode(char* buf,
+                         size_t len,
+                         const char* src,
+                         size_t srcLen) {
+        uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
+        uint8_t* dst_end = dst + len;
+        const char* src_end = src + srcLen;
+
+        // the kernel runs until it sees whitespace (or runs out of input),
+        // the scalar path steps over one group and hands back to it
+        while (dst < dst_end) {
+            kernel().decode(src, src_end, dst, dst_end);
+            if (!decode_group(src, src_end, dst, dst_end))
+                break;
+        }
+
+        return dst - reinterpret_cast<uint8_t*>(buf);
+    };
+    
+    
+    //
+    // Incremental encoder
+    //
+    
+    size_t base64_encoder::encode(const char*& src, const char* src_end, char* dst, char* dst_end) noexcept {
+        const char* table = m_url_safe ? base64url_table : base64_table;
+        char* out = dst;
+        
+        // complete the group left over from the last call
+        if (m_count > 0) {
+            if (m_count + (src_end - src) < 3) {
+                while (src < src_end)
+                    m_pending[m_count++] = *src++;
+                return 0;
+            }
+            if (dst_end - out < 4)
+                return 0;
+            
+            uint8_t group[3] = {m_pending[0], m_pending[1], 0};
+            for (unsigned i = m_count; i < 3; ++i)
+                group[i] = *src++;
+            m_count = 0;
+            
+            out[0] = table[group[0] >> 2];
+            out[1] = table[((group[0] & 3) << 4) | (group[1] >> 4)];
+            out[2] = table[((group[1] & 0x0f) << 2) | (group[2] >> 6)];
+            out[3] = table[group[2] & 0x3f];
+            out += 4;
+        }
+        
+        const size_t groups = std::min<size_t>((src_end - src) / 3, (dst_end - out) / 4);
+        out += base64_encode(src, groups * 3, out, groups * 4, m_url_safe);
+        src += groups * 3;
+        
+        // keep the tail for the next call or finish()
+        if (src_end - src < 3) {
+            while (src < src_end)
+                m_pending[m_count++] = *src++;
+        }
+        
+        return out - dst;
+    };
+    
+    
+    size_t base64_encoder::finish(char* dst, char* dst_end) noexcept {
+        if (m_count == 0 || dst_end - dst < 4)
+            return 0;
+        
+        const char* table = m_url_safe ? base64url_table : base64_table;
+        const unsigned a = m_pending[0];
+        const unsigned b = m_count > 1 ? m_pending[1] : 0;
+        
+        dst[0] = table[a >> 2];
+        dst[1] = table[((a & 3) << 4) | (b >> 4)];
+        dst[2] = m_count > 1 ? table[(b & 0x0f) << 2] : '=';
+        dst[3] = '=';
+        m_count = 0;
+        return 4;
+    };
+    
+    
+    //
+    // Incremental decoder
+    //
+    
+    size_t base64_decoder::decode(const char*& src, const char* src_end, char* out, char* out_end) noexcept {
+        uint8_t* dst = reinterpret_cast<uint8_t*>(out);
+        uint8_t* dst_end = reinterpret_cast<uint8_t*>(out_end);
+        
+        while (!m_done && src < src_end) {
+            if (m_count == 0) {
+                kernel().decode(src, src_end, dst, dst_end);
+                if (src == src_end)
+                    break;
+            }
+            
+            // only stop for lack of room right before a group is written
+            const char c = *src;
+            const int8_t value = unbase64(c);
+            if (value >= 0) {
+                if (m_count == 3 && dst_end - dst < 3)
+                    break;
+                m_pending[m_count++] = value;
+                if (m_count == 4)
+                    dst += flush(dst, dst_end);
+            } else if (c == '=') {
+                if (m_count > 1 && dst_end - dst < m_count - 1)
+                    break;
+                m_done = true;
+                dst += flush(dst, dst_end);
+            }
+            ++src;
+        }
+        
+        if (m_done)
+            src = src_end;
+        
+        return dst - reinterpret_cast<uint8_t*>(out);
+    };
+    
+    
+    size_t base64_decoder::finish(char* dst, char* dst_end) noexcept {
+        return flush(reinterpret_cast<uint8_t*>(dst), reinterpret_cast<uint8_t*>(dst_end));
+    };
+    
+    
+    size_t base64_decoder::flush(uint8_t* dst, uint8_t* dst_end) noexcept {
+        // a single character doesn't make a byte
+        const size_t count = m_count < 2 ? 0 : m_count - 1;
+        if (static_cast<size_t>(dst_end - dst) < count)
+            return 0;
+        
+        const uint8_t* v = m_pending;
+        if (count > 0)
+            dst[0] = (v[0] << 2) | ((v[1] & 0x30) >> 4);
+        if (count > 1)
+            dst[1] = ((v[1] & 0x0F) << 4) | ((v[2] & 0x3C) >> 2);
+        if (count > 2)
+            dst[2] = ((v[2] & 0x03) << 6) | (v[3] & 0x3F);
+        m_count = 0;
+        return count;
+    };
+}
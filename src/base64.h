@@ -0,0 +1,131 @@
+//
+//  base64.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__base64__
+#define __ngn__base64__
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace ngn {
+    //// Base 64 ////
+    
+    inline size_t base64_encoded_size(size_t size) {
+        return (size + 2 - ((size + 2) % 3)) / 3 * 4;
+    };
+    
+    // Doesn't check for padding at the end.  Can be 1-2 bytes over.
+    inline size_t base64_decoded_size_fast(size_t size) {
+        size_t remainder = size % 4;
+        
+        size = (size / 4) * 3;
+        if (remainder) {
+            if (size == 0 && remainder == 1) {
+                // special case: 1-byte input cannot be decoded
+                size = 0;
+            } else {
+                // non-padded input, add 1 or 2 extra bytes
+                size += 1 + (remainder == 3);
+            }
+        }
+        
+        return size;
+    };
+    
+    template <typename TypeName>
+    size_t base64_decoded_size(const TypeName* src, size_t size) {
+        if (size == 0)
+            return 0;
+        
+        if (src[size - 1] == '=')
+            size--;
+        if (size > 0 && src[size - 1] == '=')
+            size--;
+        
+        return base64_decoded_size_fast(size);
+    };
+    
+    // sextet value of a base64 character, regular and URL-safe alphabets
+    // are both accepted. returns -1 for anything else
+    int base64_value(char c) noexcept;
+    
+    // writes base64_encoded_size(slen) characters to dst, padded with '='.
+    // url_safe swaps '+' and '/' for '-' and '_'.
+    // returns the number of characters written
+    size_t base64_encode(const char* src,
+                         size_t slen,
+                         char* dst,
+                         size_t dlen,
+                         bool url_safe = false);
+    
+    // decodes both alphabets. characters outside of the alphabet (whitespace,
+    // line breaks) are skipped, '=' ends the input. a trailing group of 2 or 3
+    // characters yields 1 or 2 bytes. returns the number of bytes written,
+    // never more than len
+    size_t base64_decode(char* buf,
+                         size_t len,
+                         const char* src,
+                         size_t srcLen);
+    
+    // Incremental encoder, holds on to the bytes of an unfinished group
+    // between calls so the input can be split anywhere. Small and trivially
+    // copyable so codecvt_base64 can keep it in a std::mbstate_t; all zeroes
+    // is the initial state
+    class base64_encoder {
+    public:
+        explicit base64_encoder(bool url_safe = false) noexcept : m_url_safe(url_safe) {}
+        
+        // encodes [src, src_end) into [dst, dst_end), advancing src past
+        // everything consumed. stops early when dst is full.
+        // returns the number of characters written
+        size_t encode(const char*& src, const char* src_end, char* dst, char* dst_end) noexcept;
+        
+        // writes the padded final group, if any. needs room for 4 characters,
+        // returns the number written
+        size_t finish(char* dst, char* dst_end) noexcept;
+        
+        bool has_pending() const noexcept {
+            return m_count != 0;
+        };
+    private:
+        uint8_t m_pending[2] = {};
+        uint8_t m_count = 0;
+        bool m_url_safe = false;
+    };
+    
+    // Incremental decoder, the streaming counterpart of base64_decode. A group
+    // split across chunks is carried over to the next call; a short final
+    // group is written when '=' shows up or by finish() for unpadded input.
+    // Input after '=' is consumed and ignored
+    class base64_decoder {
+    public:
+        // decodes [src, src_end) into [dst, dst_end), advancing src past
+        // everything consumed. stops early when dst can't take the next
+        // group. returns the number of bytes written
+        size_t decode(const char*& src, const char* src_end, char* dst, char* dst_end) noexcept;
+        
+        // writes the 1 or 2 bytes of an unpadded short group, if any
+        size_t finish(char* dst, char* dst_end) noexcept;
+        
+        // largest output decode() + finish() can produce for n more characters
+        size_t max_decoded_size(size_t n) const noexcept {
+            return (m_count + n) / 4 * 3 + 2;
+        };
+        
+        bool done() const noexcept {
+            return m_done;
+        };
+    private:
+        size_t flush(uint8_t* dst, uint8_t* dst_end) noexcept;
+        
+        uint8_t m_pending[4] = {};
+        uint8_t m_count = 0;
+        bool m_done = false;
+    };
+}
+
+#endif /* defined(__ngn__base64__) */
@@ -46,12 +46,13 @@ namespace ngn {
     };
     
     // copy constructor
-    Buffer::Buffer(const Buffer& other) : Buffer(other.size()) {
-        std::copy_n(other.buffer_.base, buffer_.len, buffer_.base);
-    };
+    // shares the underlying storage, same as assignment
+    Buffer::Buffer(const Buffer& other)
+    : buffer_(other.buffer_), base_(other.base_) {};
     
     // move constructor
-    Buffer::Buffer(Buffer&& other) noexcept {
+    Buffer::Buffer(Buffer&& other) noexcept
+    : buffer_(uv_buf_init(0, 0)), base_(nullptr) {
         using std::swap;
         swap(base_, other.base_);
         swap(buffer_, other.buffer_);
@@ -85,6 +86,12 @@ namespace ngn {
         std::fill_n(begin, size, c);
     }
     
+    Buffer Buffer::clone() const {
+        Buffer buf(size());
+        if (!empty()) std::memcpy(buf.buffer_.base, buffer_.base, buffer_.len);
+        return buf;
+    };
+    
     Buffer Buffer::slice(iterator begin, iterator end) const{
         Buffer buf;
         buf.base_ = base_;
@@ -217,4 +224,68 @@ namespace ngn {
         return Buffer::reverse_iterator(begin());
     };
     
+    
+    //
+    // BufferChain
+    //
+    void BufferChain::push_back(const Buffer& chunk) {
+        if (chunk.empty()) return;
+        size_ += chunk.size();
+        chunks_.push_back(chunk);
+    };
+    void BufferChain::push_back(Buffer&& chunk) {
+        if (chunk.empty()) return;
+        size_ += chunk.size();
+        chunks_.push_back(std::move(chunk));
+    };
+    void BufferChain::push_front(const Buffer& chunk) {
+        if (chunk.empty()) return;
+        size_ += chunk.size();
+        chunks_.insert(chunks_.begin(), chunk);
+    };
+    void BufferChain::clear() noexcept {
+        chunks_.clear();
+        size_ = 0;
+    };
+    
+    BufferChain::size_type BufferChain::size() const noexcept {
+        return size_;
+    };
+    BufferChain::size_type BufferChain::chunk_count() const noexcept {
+        return chunks_.size();
+    };
+    bool BufferChain::empty() const noexcept {
+        return size_ == 0;
+    };
+    
+    const Buffer& BufferChain::front() const {
+        return chunks_.front();
+    };
+    const Buffer& BufferChain::back() const {
+        return chunks_.back();
+    };
+    
+    BufferChain::iterator BufferChain::begin() {
+        return chunks_.begin();
+    };
+    BufferChain::iterator BufferChain::end() {
+        return chunks_.end();
+    };
+    BufferChain::const_iterator BufferChain::begin() const {
+        return chunks_.begin();
+    };
+    BufferChain::const_iterator BufferChain::end() const {
+        return chunks_.end();
+    };
+    
+    Buffer BufferChain::flatten() const {
+        if (chunks_.size() == 1) return chunks_.front();
+        Buffer ret(size_);
+        auto output = ret.begin();
+        for (auto& chunk : chunks_) {
+            output = std::copy(chunk.begin(), chunk.end(), output);
+        }
+        return ret;
+    };
+    
 };
\ No newline at end of file
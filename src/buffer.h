@@ -11,6 +11,8 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <cstring>
 #include <algorithm>
 #include <type_traits>
 #include <codecvt>
@@ -105,6 +107,8 @@ namespace ngn {
     
     
     
+    class BufferChain;
+    
     class Buffer {
     public:
         //
@@ -133,11 +137,12 @@ namespace ngn {
         //
         // Static methods
         //
+        
+        // Chains the buffers together without copying them,
+        // call flatten() on the result if you need contiguous memory
         template<typename iterator_type>
-        static enable_if_same<typename iterator_type::value_type, Buffer, Buffer>
-        concat(iterator_type begin, iterator_type end){
-            return ngn::concat<Buffer>(begin, end);
-        };
+        static typename enable_if_same<typename iterator_type::value_type, Buffer, BufferChain>::type
+        concat(iterator_type begin, iterator_type end);
         
         //
         // Constructors
@@ -169,6 +174,8 @@ namespace ngn {
         };
         
         // copy/move constructor
+        // copies are views that share storage with other, use clone()
+        // if you need a deep copy
         Buffer(const Buffer& other);
         Buffer(Buffer&& other) noexcept;
         
@@ -259,6 +266,7 @@ namespace ngn {
         reverse_iterator rend();
         
         // Modifiers
+        Buffer clone() const;
         Buffer copy(iterator target_begin, iterator target_end, iterator source_begin, iterator source_end);
         
         void fill(const_reference c);
@@ -267,9 +275,8 @@ namespace ngn {
         void fill_n(const_reference c, iterator begin, size_type size);
         
         Buffer slice(iterator begin, iterator end) const;
-        template <class container, class iterator>
-        friend container concat(iterator, iterator, size_type);
-        friend Buffer concat<Buffer, typename vector<Buffer>::iterator>(typename vector<Buffer>::iterator, typename vector<Buffer>::iterator, size_type);
+        template <class container, class iterator_type>
+        friend container concat(iterator_type, iterator_type, size_t);
         operator uv_buf_t() {
             return buffer_;
         }
@@ -289,7 +296,59 @@ namespace ngn {
         
     };
     
+    //
+    // An ordered list of Buffer slices that can be treated as one logical
+    // buffer. Adding a chunk only bumps its reference count, the bytes are
+    // only copied if you ask for contiguous memory with flatten()
+    //
+    class BufferChain {
+    public:
+        typedef vector<Buffer> chunk_list;
+        typedef chunk_list::const_iterator const_iterator;
+        typedef chunk_list::iterator iterator;
+        typedef Buffer::size_type size_type;
+        
+        BufferChain() : size_(0) {};
+        
+        template<class iterator_type>
+        BufferChain(iterator_type begin, iterator_type end) : size_(0) {
+            chunks_.reserve(std::distance(begin, end));
+            std::for_each(begin, end, [this] (const Buffer& chunk) {
+                push_back(chunk);
+            });
+        };
+        
+        void push_back(const Buffer& chunk);
+        void push_back(Buffer&& chunk);
+        void push_front(const Buffer& chunk);
+        void clear() noexcept;
+        
+        // total number of bytes in the chain
+        size_type size() const noexcept;
+        size_type chunk_count() const noexcept;
+        bool empty() const noexcept;
+        
+        const Buffer& front() const;
+        const Buffer& back() const;
+        
+        iterator begin();
+        iterator end();
+        const_iterator begin() const;
+        const_iterator end() const;
+        
+        // returns the chain as a single Buffer
+        // only copies when there is more than one chunk
+        Buffer flatten() const;
+    private:
+        chunk_list chunks_;
+        size_type size_;
+    };
     
+    template<typename iterator_type>
+    typename enable_if_same<typename iterator_type::value_type, Buffer, BufferChain>::type
+    Buffer::concat(iterator_type begin, iterator_type end) {
+        return BufferChain(begin, end);
+    };
     
 };
 #endif
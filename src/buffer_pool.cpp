@@ -0,0 +1,115 @@
+//
+//  buffer_pool.cpp
+//  ngn
+//
+//
+//
+
+#include "buffer_pool.h"
+#include <algorithm>
+#include <cassert>
+
+namespace ngn { namespace experimental {
+    typedef BufferPool::size_type size_type;
+    
+    const size_type BufferPool::default_slab_size;
+    const size_type BufferPool::min_reservation;
+    const size_type BufferPool::max_cached;
+    const size_type BufferPool::min_size_class;
+    const size_type BufferPool::max_size_class;
+    
+    // keep reads aligned so copies out of them stay fast
+    static const size_type read_alignment = alignof(std::max_align_t);
+    
+    BufferPool::BufferPool(size_type slab_size)
+    : m_slabs{slab_size, 0, {}, false}, m_slab(0), m_offset(0), m_reserved(0) {
+        for (size_type size = min_size_class; size <= max_size_class; size <<= 1) {
+            m_classes.push_back(size_class{size, 0, {}, false});
+        }
+        m_slab = take(m_slabs);
+    };
+    
+    //
+    // Reads
+    //
+    uv_buf_t BufferPool::reserve(size_type size) {
+        assert(m_reserved == 0 && "reserve() called twice without commit()");
+        Buffer& slab = m_slabs.buffers[m_slab];
+        // every slice has been released, start over
+        if (slab.is_unique()) m_offset = 0;
+        if (slab.size() - m_offset < std::min(size, min_reservation)) {
+            m_slab = take(m_slabs);
+            m_offset = 0;
+        }
+        Buffer& current = m_slabs.buffers[m_slab];
+        m_reserved = std::min(size, current.size() - m_offset);
+        return uv_buf_init(reinterpret_cast<char*>(current.data() + m_offset),
+                           static_cast<unsigned int>(m_reserved));
+    };
+    
+    Buffer BufferPool::commit(size_type count) {
+        assert(count <= m_reserved);
+        m_reserved = 0;
+        if (count == 0) return Buffer();
+        Buffer& slab = m_slabs.buffers[m_slab];
+        Buffer ret = slab.slice(m_offset, count);
+        m_offset = std::min(slab.size(), (m_offset + count + read_alignment - 1) & ~(read_alignment - 1));
+        return ret;
+    };
+    
+    //
+    // Size Class Cache
+    //
+    Buffer BufferPool::acquire(size_type size) {
+        size_class* cls = class_for(size);
+        if (cls == nullptr) return Buffer(size);
+        if (cls->pinned) {
+            // a pinned class never gives up its buffers, when they're all
+            // in use the caller gets one of its own
+            for (auto& buffer : cls->buffers) {
+                if (buffer.is_unique()) return buffer.slice(0, size);
+            }
+            return Buffer(size);
+        }
+        return cls->buffers[take(*cls)].slice(0, size);
+    };
+    
+    std::vector<uv_buf_t> BufferPool::pin(size_type size) {
+        std::vector<uv_buf_t> ranges;
+        size_class* cls = class_for(size);
+        if (cls == nullptr) return ranges;
+        cls->pinned = true;
+        while (cls->buffers.size() < max_cached) {
+            cls->buffers.emplace_back(cls->size);
+        }
+        for (auto& buffer : cls->buffers) {
+            ranges.push_back(uv_buf_init(reinterpret_cast<char*>(buffer.data()),
+                                         static_cast<unsigned int>(buffer.size())));
+        }
+        return ranges;
+    };
+    
+    size_type BufferPool::take(size_class& cls) {
+        for (size_type i = 0; i < cls.buffers.size(); i++) {
+            if (cls.buffers[i].is_unique()) return i;
+        }
+        if (cls.buffers.size() < max_cached) {
+            cls.buffers.emplace_back(cls.size);
+            return cls.buffers.size() - 1;
+        }
+        // every cached buffer is in use, replace one of them
+        // the old buffer is freed once its last slice is released
+        size_type victim = cls.next_victim;
+        cls.next_victim = (victim + 1) % max_cached;
+        cls.buffers[victim] = Buffer(cls.size);
+        return victim;
+    };
+    
+    BufferPool::size_class* BufferPool::class_for(size_type size) {
+        if (size > max_size_class) return nullptr;
+        for (auto& cls : m_classes) {
+            if (size <= cls.size) return &cls;
+        }
+        return nullptr;
+    };
+}}
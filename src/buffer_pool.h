@@ -0,0 +1,85 @@
+//
+//  buffer_pool.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__buffer_pool__
+#define __ngn__buffer_pool__
+
+#include <vector>
+#include <uv.h>
+#include "io_buffer.h"
+
+namespace ngn { namespace experimental {
+    //
+    // Recycles Buffers for an isolate
+    //
+    // Reads are carved out of a shared slab: reserve() hands libuv the free
+    // space at the end of the slab and commit() turns the bytes that were
+    // actually read into a refcounted slice, the rest stays in the pool.
+    // Once every slice of a slab has been released the slab is reused.
+    //
+    // acquire() returns whole buffers from a small per size class cache,
+    // a cached buffer is handed out again once nobody else references it.
+    //
+    // Not thread safe, only use it from the isolate's thread. The buffers it
+    // returns can be passed to other threads.
+    //
+    class BufferPool {
+    public:
+        using size_type = Buffer::size_type;
+        
+        static const size_type default_slab_size = 64 * 1024;
+        // rotate the slab when less than this is left for a read
+        static const size_type min_reservation = 4 * 1024;
+        // buffers cached per size class
+        static const size_type max_cached = 8;
+        static const size_type min_size_class = 4 * 1024;
+        static const size_type max_size_class = 1024 * 1024;
+        
+        explicit BufferPool(size_type slab_size = default_slab_size);
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+        
+        //
+        // Reads
+        //
+        // reserves up to size bytes for a read, the space is returned
+        // to the pool by the next call to commit()
+        uv_buf_t reserve(size_type size);
+        // returns the first count bytes of the last reservation
+        Buffer commit(size_type count);
+        
+        //
+        // Size Class Cache
+        //
+        // returns a buffer of exactly size bytes
+        Buffer acquire(size_type size);
+        // fills the size class that serves size and never replaces its
+        // buffers, so their memory stays put for as long as the pool lives
+        // and can be registered with the kernel. Returns the pinned ranges,
+        // none if size is too big to be cached
+        std::vector<uv_buf_t> pin(size_type size);
+        
+    private:
+        struct size_class {
+            size_type size;
+            size_type next_victim;
+            std::vector<Buffer> buffers;
+            bool pinned;
+        };
+        // index of a cached buffer that nobody else references
+        size_type take(size_class& cls);
+        size_class* class_for(size_type size);
+        
+        size_class m_slabs;
+        size_type m_slab;
+        size_type m_offset;
+        size_type m_reserved;
+        std::vector<size_class> m_classes;
+    };
+}}
+
+#endif /* defined(__ngn__buffer_pool__) */
@@ -0,0 +1,229 @@
+//
+//  buffer_queue.cpp
+//  ngn
+//
+//
+//
+
+#include "buffer_queue.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace ngn { namespace experimental {
+    typedef BufferQueue::size_type size_type;
+    typedef BufferQueue::iterator iterator;
+    typedef BufferQueue::const_iterator const_iterator;
+    
+    const size_type BufferQueue::default_chunk_size;
+    
+    //
+    // Constructors
+    //
+    BufferQueue::BufferQueue(size_type chunk_size)
+    : size_(0), chunk_size_(chunk_size) {};
+    
+    BufferQueue::BufferQueue(BufferQueue&& other) noexcept
+    : chunks_(std::move(other.chunks_)), size_(other.size_), chunk_size_(other.chunk_size_) {
+        other.size_ = 0;
+    };
+    
+    BufferQueue& BufferQueue::operator=(BufferQueue other) noexcept {
+        this->swap(other);
+        return *this;
+    };
+    
+    //
+    // Modifiers
+    //
+    void BufferQueue::append(Buffer chunk) {
+        if (chunk.empty()) return;
+        size_ += chunk.size();
+        chunks_.push_back(std::move(chunk));
+    };
+    
+    void BufferQueue::append(BufferQueue&& other) {
+        for (auto& chunk : other.chunks_) {
+            append(std::move(chunk));
+        }
+        other.clear();
+    };
+    
+    void BufferQueue::append(const void* data, size_type size) {
+        auto src = static_cast<const value_type*>(data);
+        while (size > 0) {
+            size_type room = tailroom();
+            if (room == 0) {
+                // the tail is shared or full, start a new chunk
+                Buffer chunk(std::max(size, chunk_size_));
+                chunk.trim_end(chunk.size());
+                chunks_.push_back(std::move(chunk));
+                room = chunks_.back().tailroom();
+            }
+            Buffer& tail = chunks_.back();
+            size_type count = std::min(room, size);
+            std::memcpy(tail.end(), src, count);
+            tail.append(count);
+            size_ += count;
+            src += count;
+            size -= count;
+        }
+    };
+    
+    void BufferQueue::prepend(Buffer chunk) {
+        if (chunk.empty()) return;
+        size_ += chunk.size();
+        chunks_.push_front(std::move(chunk));
+    };
+    
+    void BufferQueue::prepend(const void* data, size_type size) {
+        if (size == 0) return;
+        auto src = static_cast<const value_type*>(data);
+        if (headroom() < size) {
+            // leave the new bytes at the end of the chunk so later
+            // prepends can use the space in front of them
+            Buffer chunk(std::max(size, chunk_size_));
+            chunk.trim_start(chunk.size());
+            chunks_.push_front(std::move(chunk));
+        }
+        Buffer& head = chunks_.front();
+        head.prepend(size);
+        std::memcpy(head.begin(), src, size);
+        size_ += size;
+    };
+    
+    BufferQueue BufferQueue::split(size_type count) {
+        if (count > size_)
+            throw std::out_of_range("count must not exceed the size of the queue");
+        BufferQueue ret(chunk_size_);
+        while (count > 0) {
+            Buffer& head = chunks_.front();
+            if (head.size() <= count) {
+                count -= head.size();
+                size_ -= head.size();
+                ret.append(std::move(head));
+                chunks_.pop_front();
+            } else {
+                ret.append(head.slice(0, count));
+                head.trim_start(count);
+                size_ -= count;
+                count = 0;
+            }
+        }
+        return ret;
+    };
+    
+    void BufferQueue::trim_start(size_type count) {
+        if (count > size_)
+            throw std::out_of_range("count must not exceed the size of the queue");
+        size_ -= count;
+        while (count > 0) {
+            Buffer& head = chunks_.front();
+            if (head.size() <= count) {
+                count -= head.size();
+                chunks_.pop_front();
+            } else {
+                head.trim_start(count);
+                count = 0;
+            }
+        }
+    };
+    
+    void BufferQueue::trim_end(size_type count) {
+        if (count > size_)
+            throw std::out_of_range("count must not exceed the size of the queue");
+        size_ -= count;
+        while (count > 0) {
+            Buffer& tail = chunks_.back();
+            if (tail.size() <= count) {
+                count -= tail.size();
+                chunks_.pop_back();
+            } else {
+                tail.trim_end(count);
+                count = 0;
+            }
+        }
+    };
+    
+    void BufferQueue::clear() noexcept {
+        chunks_.clear();
+        size_ = 0;
+    };
+    
+    void BufferQueue::swap(BufferQueue& other) noexcept {
+        using std::swap;
+        swap(chunks_, other.chunks_);
+        swap(size_, other.size_);
+        swap(chunk_size_, other.chunk_size_);
+    };
+    
+    Buffer BufferQueue::coalesce() const {
+        if (chunks_.size() == 1) return chunks_.front();
+        Buffer ret(size_);
+        auto output = ret.begin();
+        for (auto& chunk : chunks_) {
+            output = std::copy(chunk.begin(), chunk.end(), output);
+        }
+        return ret;
+    };
+    
+    //
+    // Capacity
+    //
+    size_type BufferQueue::size() const noexcept {
+        return size_;
+    };
+    size_type BufferQueue::chunk_count() const noexcept {
+        return chunks_.size();
+    };
+    bool BufferQueue::empty() const noexcept {
+        return size_ == 0;
+    };
+    size_type BufferQueue::headroom() const noexcept {
+        if (chunks_.empty() || !chunks_.front().is_unique()) return 0;
+        return chunks_.front().headroom();
+    };
+    size_type BufferQueue::tailroom() const noexcept {
+        if (chunks_.empty() || !chunks_.back().is_unique()) return 0;
+        return chunks_.back().tailroom();
+    };
+    
+    //
+    // Scatter/Gather
+    //
+    size_type BufferQueue::iovec(uv_buf_t* bufs, size_type count) const noexcept {
+        size_type filled = 0;
+        for (auto i = chunks_.begin(); i != chunks_.end() && filled < count; ++i) {
+            bufs[filled++] = *i;
+        }
+        return filled;
+    };
+    
+    std::vector<uv_buf_t> BufferQueue::iovec() const {
+        std::vector<uv_buf_t> bufs(chunks_.size());
+        iovec(bufs.data(), bufs.size());
+        return bufs;
+    };
+    
+    //
+    // Iterators
+    //
+    iterator BufferQueue::begin() {
+        return chunks_.begin();
+    };
+    iterator BufferQueue::end() {
+        return chunks_.end();
+    };
+    const_iterator BufferQueue::begin() const {
+        return chunks_.begin();
+    };
+    const_iterator BufferQueue::end() const {
+        return chunks_.end();
+    };
+    const Buffer& BufferQueue::front() const {
+        return chunks_.front();
+    };
+    const Buffer& BufferQueue::back() const {
+        return chunks_.back();
+    };
+}}
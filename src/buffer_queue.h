@@ -0,0 +1,98 @@
+//
+//  buffer_queue.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__buffer_queue__
+#define __ngn__buffer_queue__
+
+#include <deque>
+#include <vector>
+#include <uv.h>
+#include "io_buffer.h"
+
+namespace ngn { namespace experimental {
+    //
+    // A chain of Buffers that is treated as one logical sequence of bytes
+    // Appending or prepending a Buffer never copies, raw bytes are copied
+    // into the headroom/tailroom of the first/last chunk when we are the
+    // only ones referencing it, otherwise a new chunk is allocated
+    //
+    class BufferQueue {
+    public:
+        using chunk_list        = std::deque<Buffer>;
+        using iterator          = chunk_list::iterator;
+        using const_iterator    = chunk_list::const_iterator;
+        using size_type         = Buffer::size_type;
+        using value_type        = Buffer::value_type;
+        
+        // minimum size of the chunks allocated by append/prepend
+        static const size_type default_chunk_size = 4096;
+        
+        explicit BufferQueue(size_type chunk_size = default_chunk_size);
+        BufferQueue(const BufferQueue&) = default;
+        BufferQueue(BufferQueue&& other) noexcept;
+        BufferQueue& operator=(BufferQueue other) noexcept;
+        
+        //
+        // Modifiers
+        //
+        void append(Buffer chunk);
+        void append(BufferQueue&& other);
+        void append(const void* data, size_type size);
+        void prepend(Buffer chunk);
+        void prepend(const void* data, size_type size);
+        
+        // removes the first count bytes and returns them as a new queue
+        // chunks that straddle the split point are sliced, not copied
+        BufferQueue split(size_type count);
+        void trim_start(size_type count);
+        void trim_end(size_type count);
+        void clear() noexcept;
+        void swap(BufferQueue& other) noexcept;
+        
+        // returns the contents as one Buffer, only copies if there is
+        // more than one chunk
+        Buffer coalesce() const;
+        
+        //
+        // Capacity
+        //
+        size_type size() const noexcept;
+        size_type chunk_count() const noexcept;
+        bool empty() const noexcept;
+        // writable space before/after the data without allocating
+        size_type headroom() const noexcept;
+        size_type tailroom() const noexcept;
+        
+        //
+        // Scatter/Gather
+        //
+        // fills up to count uv_buf_t's and returns how many were written
+        size_type iovec(uv_buf_t* bufs, size_type count) const noexcept;
+        std::vector<uv_buf_t> iovec() const;
+        
+        //
+        // Iterators
+        //
+        iterator begin();
+        iterator end();
+        const_iterator begin() const;
+        const_iterator end() const;
+        const Buffer& front() const;
+        const Buffer& back() const;
+        
+    private:
+        chunk_list chunks_;
+        size_type size_;
+        size_type chunk_size_;
+    };
+    
+    inline void swap(BufferQueue& lhs, BufferQueue& rhs) noexcept {
+        lhs.swap(rhs);
+    }
+}}
+
+#endif /* defined(__ngn__buffer_queue__) */
@@ -0,0 +1,28 @@
+//
+//  cpu_features.cpp
+//  ngn
+//
+//
+//
+
+#include "cpu_features.h"
+
+namespace ngn { namespace cpu {
+    static features query() noexcept {
+        features result;
+#if defined(NGN_HAVE_X86_DISPATCH)
+        // required when called before main()
+        __builtin_cpu_init();
+        result.sse41 = __builtin_cpu_supports("sse4.1");
+        result.avx2 = __builtin_cpu_supports("avx2");
+#elif defined(NGN_HAVE_NEON)
+        result.neon = true;
+#endif
+        return result;
+    }
+    
+    const features& detect() noexcept {
+        static const features cached = query();
+        return cached;
+    }
+}}
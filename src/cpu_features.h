@@ -0,0 +1,35 @@
+//
+//  cpu_features.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__cpu_features__
+#define __ngn__cpu_features__
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NGN_HAVE_X86_DISPATCH 1
+// compiles a single function for a newer instruction set than the rest of
+// the build, only call it after checking detect()
+#define NGN_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// part of the aarch64 baseline, no runtime check needed to compile it in
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define NGN_HAVE_NEON 1
+#endif
+
+namespace ngn { namespace cpu {
+    struct features {
+        bool sse41 = false;
+        bool avx2 = false;
+        bool neon = false;
+    };
+    
+    // queries cpuid the first time it is called, the result is cached
+    // kernels use it to pick their implementation once
+    const features& detect() noexcept;
+}}
+
+#endif /* defined(__ngn__cpu_features__) */
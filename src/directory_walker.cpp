@@ -0,0 +1,244 @@
+//
+//  directory_walker.cpp
+//  ngn
+//
+//
+//
+
+#include "directory_walker.h"
+#include <cstring>
+#include <stdexcept>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace ngn {
+    const DirectoryWalker::size_type DirectoryWalker::default_high_water_mark;
+
+    namespace {
+        DirectoryEntry::Type type_of(mode_t mode) {
+            switch (mode & S_IFMT) {
+                case S_IFREG: return DirectoryEntry::File;
+                case S_IFDIR: return DirectoryEntry::Directory;
+                case S_IFLNK: return DirectoryEntry::Link;
+                case S_IFIFO: return DirectoryEntry::Fifo;
+                case S_IFSOCK: return DirectoryEntry::Socket;
+                case S_IFCHR: return DirectoryEntry::Character;
+                case S_IFBLK: return DirectoryEntry::Block;
+                default: return DirectoryEntry::Unknown;
+            }
+        }
+
+        DirectoryEntry::Type type_of(const struct dirent* dirent) {
+#ifdef DT_UNKNOWN
+            switch (dirent->d_type) {
+                case DT_REG: return DirectoryEntry::File;
+                case DT_DIR: return DirectoryEntry::Directory;
+                case DT_LNK: return DirectoryEntry::Link;
+                case DT_FIFO: return DirectoryEntry::Fifo;
+                case DT_SOCK: return DirectoryEntry::Socket;
+                case DT_CHR: return DirectoryEntry::Character;
+                case DT_BLK: return DirectoryEntry::Block;
+                default: return DirectoryEntry::Unknown;
+            }
+#else
+            return DirectoryEntry::Unknown;
+#endif
+        }
+
+        // same layout libuv reports from uv_fs_stat
+        void to_uv_stat(const struct stat& in, uv_stat_t& out) {
+            std::memset(&out, 0, sizeof(out));
+            out.st_dev = in.st_dev;
+            out.st_mode = in.st_mode;
+            out.st_nlink = in.st_nlink;
+            out.st_uid = in.st_uid;
+            out.st_gid = in.st_gid;
+            out.st_rdev = in.st_rdev;
+            out.st_ino = in.st_ino;
+            out.st_size = in.st_size;
+            out.st_blksize = in.st_blksize;
+            out.st_blocks = in.st_blocks;
+#if defined(__APPLE__)
+            out.st_atim.tv_sec = in.st_atimespec.tv_sec;
+            out.st_atim.tv_nsec = in.st_atimespec.tv_nsec;
+            out.st_mtim.tv_sec = in.st_mtimespec.tv_sec;
+            out.st_mtim.tv_nsec = in.st_mtimespec.tv_nsec;
+            out.st_ctim.tv_sec = in.st_ctimespec.tv_sec;
+            out.st_ctim.tv_nsec = in.st_ctimespec.tv_nsec;
+            out.st_birthtim.tv_sec = in.st_birthtimespec.tv_sec;
+            out.st_birthtim.tv_nsec = in.st_birthtimespec.tv_nsec;
+            out.st_flags = in.st_flags;
+            out.st_gen = in.st_gen;
+#else
+            out.st_atim.tv_sec = in.st_atim.tv_sec;
+            out.st_atim.tv_nsec = in.st_atim.tv_nsec;
+            out.st_mtim.tv_sec = in.st_mtim.tv_sec;
+            out.st_mtim.tv_nsec = in.st_mtim.tv_nsec;
+            out.st_ctim.tv_sec = in.st_ctim.tv_sec;
+            out.st_ctim.tv_nsec = in.st_ctim.tv_nsec;
+            // no birth time here, libuv reports ctime as well
+            out.st_birthtim = out.st_ctim;
+#endif
+        }
+
+        bool ends_with(const char* name, size_t length, const std::string& suffix) {
+            return length >= suffix.size() &&
+                std::memcmp(name + length - suffix.size(), suffix.data(), suffix.size()) == 0;
+        }
+    }
+
+    //
+    // Construction
+    //
+
+    DirectoryWalker::DirectoryWalker(std::string root, Options options, executor& pool, isolate& isolate) :
+        ReadableStream(options.high_water_mark),
+        m_executor(pool),
+        m_isolate(isolate),
+        m_root(std::move(root)),
+        m_options(std::move(options)),
+        m_concurrency(m_options.concurrency ? m_options.concurrency : 2 * pool.size()),
+        m_running(0),
+        m_wanted(false),
+        m_finished(false) {
+        m_pending.push_back(directory{m_root, 0});
+    };
+
+    //
+    // Scheduling
+    //
+
+    void DirectoryWalker::_read(size_type count) {
+        m_wanted = true;
+        pump();
+    };
+
+    void DirectoryWalker::pump() {
+        while (m_wanted && m_running < m_concurrency && !m_pending.empty()) {
+            directory dir(std::move(m_pending.back()));
+            m_pending.pop_back();
+            start(std::move(dir));
+        }
+        if (m_running == 0 && m_pending.empty() && !m_finished) {
+            m_finished = true;
+            push(nullopt);
+        }
+    };
+
+    void DirectoryWalker::start(directory dir) {
+        ++m_running;
+        auto result = std::make_shared<listing>();
+        result->dir = std::move(dir);
+        const Options* options = &m_options;
+        m_executor.submit([result, options] {
+            scan(*result, *options);
+        }, [this, result] {
+            collect(*result);
+        }, m_isolate);
+    };
+
+    void DirectoryWalker::collect(listing& result) {
+        if (m_finished) {
+            --m_running;
+            return;
+        }
+        if (result.status < 0 && result.dir.depth == 0) {
+            --m_running;
+            m_finished = true;
+            m_pending.clear();
+            onError(std::runtime_error(std::string(uv_strerror(result.status)) + ": " + m_root));
+            return;
+        }
+        for (auto& child : result.children)
+            m_pending.push_back(std::move(child));
+        // the whole batch goes in, the walk waits for the next _read()
+        // once the stream is full
+        for (auto& entry : result.entries)
+            m_wanted = push(std::move(entry));
+        // not before the pushes, a push can call _read() which would see
+        // nothing running and end the stream early
+        --m_running;
+        pump();
+    };
+    
+    //
+    // Scanning, on the executor
+    //
+
+    bool DirectoryWalker::matches(const Options& options, const char* name, DirectoryEntry::Type type) {
+        if (!options.extensions.empty()) {
+            if (type == DirectoryEntry::Directory)
+                return false;
+            size_t length = std::strlen(name);
+            bool found = false;
+            for (auto& extension : options.extensions) {
+                if (ends_with(name, length, extension)) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+                return false;
+        }
+        return !options.filter || options.filter(name, type);
+    };
+
+    void DirectoryWalker::scan(listing& result, const Options& options) {
+        const directory& dir = result.dir;
+        // plain POSIX calls, this runs on executor threads away from the loop.
+        // stats are relative to the directory, one lookup per entry
+        int fd = ::open(dir.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        DIR* stream = fd >= 0 ? fdopendir(fd) : nullptr;
+        if (!stream) {
+            result.status = -errno;
+            if (fd >= 0)
+                ::close(fd);
+            return;
+        }
+        result.status = 0;
+        std::string prefix = dir.path;
+        if (prefix.empty() || prefix.back() != '/')
+            prefix.push_back('/');
+        bool descend = dir.depth < options.max_depth;
+
+        struct dirent* dirent;
+        while ((dirent = readdir(stream)) != nullptr) {
+            const char* name = dirent->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+            DirectoryEntry::Type type = type_of(dirent);
+            struct stat info;
+            bool has_stat = false;
+            // the filesystem didn't say, a stat is the only way to know
+            // whether to walk into it
+            if (type == DirectoryEntry::Unknown &&
+                fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) == 0) {
+                has_stat = true;
+                type = type_of(info.st_mode);
+            }
+
+            if (type == DirectoryEntry::Directory && descend &&
+                (!options.descend || options.descend(name, type)))
+                result.children.push_back(directory{prefix + name, dir.depth + 1});
+            if (!matches(options, name, type))
+                continue;
+
+            if (options.stat && !has_stat)
+                has_stat = fstatat(fd, name, &info, AT_SYMLINK_NOFOLLOW) == 0;
+            result.entries.emplace_back();
+            DirectoryEntry& entry = result.entries.back();
+            entry.path = prefix + name;
+            entry.name_offset = prefix.size();
+            entry.depth = dir.depth;
+            entry.type = type;
+            entry.has_stat = options.stat && has_stat;
+            if (entry.has_stat)
+                to_uv_stat(info, entry.stat);
+        }
+        // closes fd as well
+        closedir(stream);
+    };
+}
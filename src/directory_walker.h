@@ -0,0 +1,141 @@
+//
+//  directory_walker.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__directory_walker__
+#define __ngn__directory_walker__
+
+#include <uv.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "stream.h"
+#include "executor.h"
+#include "isolate.h"
+
+namespace ngn {
+    struct DirectoryEntry {
+        enum Type {
+            Unknown,
+            File,
+            Directory,
+            Link,
+            Fifo,
+            Socket,
+            Character,
+            Block
+        };
+        
+        // the walk's root joined with the names below it
+        std::string path;
+        size_t name_offset;
+        // how many directories below the root
+        unsigned depth;
+        Type type;
+        // only filled in when the walk stats entries
+        bool has_stat;
+        uv_stat_t stat;
+
+        const char* name() const {
+            return path.c_str() + name_offset;
+        };
+    };
+
+    //
+    // Recursive directory listing as an object mode stream of DirectoryEntry
+    //
+    // Every directory is scanned by one executor task: readdir() on the
+    // directory's descriptor, then fstatat() against that same descriptor
+    // for the entries that passed the filters, so a path is never resolved
+    // from the root again. Names are filtered with the type readdir reports
+    // before anything is stat'd, only filesystems that don't report types
+    // need a stat to tell directories apart.
+    //
+    // Up to concurrency directories are scanned at once, their entries
+    // are pushed in batches on the loop thread. New scans only start while
+    // the stream wants more, so a slow consumer pauses the walk. Entries
+    // come out in no particular order, symlinks are reported but never
+    // followed and subdirectories that can't be read are skipped. A root
+    // that can't be read is an error.
+    //
+    // The walker has to stay alive until it has ended
+    //
+    class DirectoryWalker : public ReadableStream<DirectoryEntry> {
+    public:
+        // called on executor threads, so they have to be thread safe
+        typedef std::function<bool(const char* name, DirectoryEntry::Type type)> filter_type;
+
+        static const size_type default_high_water_mark = 1024;
+
+        struct Options {
+            Options() :
+                stat(true),
+                max_depth(static_cast<unsigned>(-1)),
+                concurrency(0),
+                high_water_mark(default_high_water_mark) {};
+            
+            // entries that pass are stat'd and pushed
+            filter_type filter;
+            // only non-directories whose name ends in one of these (".png")
+            std::vector<std::string> extensions;
+            // directories that fail this aren't walked into
+            filter_type descend;
+            // fstatat() the entries that are pushed
+            bool stat;
+            // directories deeper than this aren't walked into, 0 is the root
+            unsigned max_depth;
+            // directories scanned at once, 0 picks twice the executor's threads
+            size_type concurrency;
+            size_type high_water_mark;
+        };
+
+        explicit DirectoryWalker(std::string root, Options options = Options(),
+                                 executor& pool = executor::shared(),
+                                 isolate& isolate = isolate::instance());
+
+        const std::string& root() const {
+            return m_root;
+        };
+
+    protected:
+        void _read(size_type count) override;
+
+    private:
+        struct directory {
+            std::string path;
+            unsigned depth;
+        };
+        // one directory's worth of results, filled in on the executor
+        struct listing {
+            directory dir;
+            int status;
+            std::vector<DirectoryEntry> entries;
+            std::vector<directory> children;
+        };
+
+        static void scan(listing& result, const Options& options);
+        static bool matches(const Options& options, const char* name, DirectoryEntry::Type type);
+        // starts scans while the stream wants entries, ends it when done
+        void pump();
+        void start(directory dir);
+        void collect(listing& result);
+
+        executor& m_executor;
+        isolate& m_isolate;
+        std::string m_root;
+        // read concurrently by the scans, never changed after construction
+        const Options m_options;
+        size_type m_concurrency;
+        // directories found but not scanned yet, walked depth first
+        std::vector<directory> m_pending;
+        size_type m_running;
+        bool m_wanted;
+        bool m_finished;
+    };
+}
+
+#endif /* defined(__ngn__directory_walker__) */
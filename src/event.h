@@ -17,9 +17,11 @@
 #include <typeinfo>
 #include <iostream>
 #include <deque>
+#include <vector>
 #include <atomic>
 #include <memory>
 #include <algorithm>
+#include "inplace_function.h"
 
 namespace ngn { namespace events {
   template <class Handler, class Allocator>
@@ -103,10 +105,10 @@ namespace ngn { namespace events {
     return ngn::events::scoped_connection<connection>(std::forward<connection>(target));
   };
   
-  template <class Handler, class Allocator = std::allocator<std::function<Handler>>>
+  template <class Handler, class Allocator = std::allocator<ngn::inplace_function<Handler>>>
   class signal {
   public:
-    using function_type = std::function<Handler>;
+    using function_type = ngn::inplace_function<Handler>;
     using allocator_type = Allocator;
     using slot_type = std::shared_ptr<function_type>;
     using slot_list = std::vector<slot_type, typename std::allocator_traits<allocator_type>::template rebind_traits<slot_type>::allocator_type>;
@@ -147,9 +149,9 @@ namespace ngn { namespace events {
       }
       is_running = false;
     }
-    connection_type connect(const function_type& slot) {
+    connection_type connect(function_type slot) {
       auto& container = !is_running ? slots : pending_slots;
-      container.emplace_back(std::allocate_shared<function_type>(allocator, std::allocator_arg, allocator, slot));
+      container.emplace_back(std::allocate_shared<function_type>(allocator, std::move(slot)));
       return connection_type { std::weak_ptr<function_type>( container.back()) };
     }
     void disconnect_all() {
@@ -174,39 +176,56 @@ namespace ngn { namespace events {
 }
 }
 
-static unsigned long long _last_id = 0;
 template <typename... Arguments>
 class Event {
     template <class Functor>
     class EventConnection;
 public:
     typedef void (*HandlerFn)(Arguments...);
-    typedef std::function<void(Arguments...)> Handler;
+    typedef ngn::inplace_function<void(Arguments...)> Handler;
     typedef Handler handler;
-    typedef EventConnection<Handler> Connection;
-    typedef std::list<Connection> HandlerList;
+    typedef EventConnection<Handler> Listener;
+    typedef std::list<Listener> HandlerList;
     typedef typename HandlerList::iterator Binding;
     typedef Binding (*addFn)(Handler);
     typedef void (*emitFn)(Arguments...);
     typedef typename HandlerList::iterator iterator;
     
+    // identifies a listener for removeListener/off
+    class Connection {
+        friend class Event<Arguments...>;
+    public:
+        Connection() : _id(0) {};
+    private:
+        explicit Connection(unsigned long long id) : _id(id) {};
+        unsigned long long _id;
+    };
+    
     Connection addListener(Handler fn){
-        listeners_.emplace_back(fn);
-        return listeners_.back();
+        listeners_.emplace_back(std::move(fn), false, ++next_id_);
+        return Connection(listeners_.back()._id);
     };
     
     Connection on(Handler fn){
-        return addListener(fn);
+        return addListener(std::move(fn));
     };
     
     Connection once(Handler fn){
-        listeners_.emplace_back(fn, true);
-        //std::cout << "new size: " << listeners_.size() << "\n";
-        return listeners_.back();
+        listeners_.emplace_back(std::move(fn), true, ++next_id_);
+        return Connection(listeners_.back()._id);
     };
     
     void removeListener(Connection binding) {
-        
+        for (auto i = listeners_.begin(); i != listeners_.end(); ++i) {
+            if (i->_id == binding._id) {
+                // an emit may be holding on to it, it's erased when that's done
+                if (emitting_ > 0)
+                    i->marked = true;
+                else
+                    listeners_.erase(i);
+                break;
+            }
+        }
     };
     
     void off(Connection binding){
@@ -214,7 +233,13 @@ public:
     };
     
     void removeAllListeners() {
-        listeners_.clear();
+        // a running listener can't be destroyed under itself
+        if (emitting_ > 0) {
+            for (auto& listener : listeners_)
+                listener.marked = true;
+        } else {
+            listeners_.clear();
+        }
     };
     void off(){
         removeAllListeners();
@@ -230,49 +255,47 @@ public:
     
     
     void emit(Arguments&&... args) {
-        is_emitting = true;
+        ++emitting_;
         size_t size = listeners_.size();
-        auto i = listeners_.begin();
-        while (size != 0 && i != listeners_.end()) {
-            if (i->marked) {
-                i = listeners_.erase(i);
-            }
-            else {
-                auto fn = i->fn_;
-                if (i->once == true) {
-                    i = listeners_.erase(i);
-                } else {
-                    i++;
-                }
+        // nothing is erased until the outermost emit is done, so nested
+        // emits can't pull a node out from under i
+        for (auto i = listeners_.begin(); size != 0 && i != listeners_.end(); ++i, --size) {
+            if (i->marked)
+                continue;
+            if (i->once) {
+                // handlers are move-only, take it out so it survives the sweep
+                i->marked = true;
+                Handler fn = std::move(i->fn_);
                 if (fn)
                     fn(std::forward<Arguments>(args)...);
             }
-            size--;
+            else if (i->fn_) {
+                i->fn_(std::forward<Arguments>(args)...);
+            }
         }
-        is_emitting = false;
+        if (--emitting_ == 0)
+            listeners_.remove_if([](const Listener& listener) { return listener.marked; });
     }
     void operator()(Arguments&&... args){
         emit(std::forward<Arguments>(args)...);
     };
     
     Connection operator()(Handler fn){
-        return addListener(fn);
+        return addListener(std::move(fn));
     }
     
 private:
-    std::atomic<bool> is_emitting;
+    unsigned int emitting_ = 0;
     static const unsigned int argsize = sizeof...(Arguments);
     unsigned int max_listeners_ = 10;
+    // ids are per event, 0 is the empty Connection
+    unsigned long long next_id_ = 0;
     HandlerList listeners_;
     template <class Functor>
     class EventConnection {
         friend class Event<Arguments...>;
     public:
-        EventConnection (Functor fn) : fn_(fn) , _id(_last_id++) {};
-        EventConnection (Functor fn, bool once_) : fn_(fn) ,once(once_), _id(_last_id++) {};
-        EventConnection() : _id(_last_id++) {};
-        //        EventConnection(const EventConnection&) = delete;
-        //      EventConnection(EventConnection&&) = delete;
+        EventConnection (Functor fn, bool once_, unsigned long long id) : fn_(std::move(fn)) ,once(once_), _id(id) {};
         void remove() {
             marked = true;
         }
@@ -11,13 +11,97 @@
 
 namespace ngn{
     
-    //static EventLoop* default_loop_ptr = nullptr;
-    void tick(uv_idle_t* handle, int status) {
-        EventLoop* loop = reinterpret_cast<EventLoop*>(handle->data);
-        loop->nextTick();
-        loop->nextTick.removeAllListeners();
+    //
+    // TickQueue
+    //
+    
+    void TickQueue::on_check(uv_check_t* handle, int status) {
+        auto queue = static_cast<TickQueue*>(handle->data);
+        queue->drain(queue->max_per_iteration_);
+    }
+    
+    void TickQueue::on_idle(uv_idle_t* handle, int status) {
+        auto queue = static_cast<TickQueue*>(handle->data);
+        if (!queue->drain(queue->max_per_iteration_)) {
+            uv_idle_stop(&queue->idle_handle_);
+            queue->idling_ = false;
+        }
+    }
+    
+    TickQueue::TickQueue() :
+        loop_(nullptr),
+        mask_(0),
+        head_(0),
+        tail_(0),
+        max_per_iteration_(default_max_per_iteration),
+        enabled_(false),
+        idling_(false) {
+    };
+    
+    void TickQueue::push(callback fn) {
+        if (size() == mask_ + 1 || !ring_)
+            grow();
+        ring_[tail_ & mask_] = std::move(fn);
+        ++tail_;
+        if (!idling_) {
+            enable();
+            uv_idle_start(&idle_handle_, on_idle);
+            idling_ = true;
+        }
+    }
+    
+    bool TickQueue::drain(size_t limit) {
+        for (size_t count = 0; count < limit && !empty(); ++count) {
+            // moved out first so a callback that throws or queues more
+            // leaves the ring consistent
+            callback fn = std::move(ring_[head_ & mask_]);
+            ++head_;
+            fn();
+        }
+        return !empty();
+    }
+    
+    void TickQueue::grow() {
+        size_t capacity = ring_ ? (mask_ + 1) * 2 : 64;
+        std::unique_ptr<callback[]> ring(new callback[capacity]);
+        size_t count = size();
+        for (size_t i = 0; i < count; ++i)
+            ring[i] = std::move(ring_[(head_ + i) & mask_]);
+        ring_ = std::move(ring);
+        mask_ = capacity - 1;
+        head_ = 0;
+        tail_ = count;
     }
+    
+    void TickQueue::enable() {
+        if (enabled_)
+            return;
+        uv_check_init(loop_, &check_handle_);
+        uv_idle_init(loop_, &idle_handle_);
+        check_handle_.data = this;
+        idle_handle_.data = this;
+        uv_check_start(&check_handle_, on_check);
+        // the idle handle keeps the loop alive while something is queued,
+        // the check handle alone never should
+        uv_unref(reinterpret_cast<uv_handle_t*>(&check_handle_));
+        enabled_ = true;
+    }
+    
+    void TickQueue::close() {
+        if (!enabled_)
+            return;
+        uv_close(reinterpret_cast<uv_handle_t*>(&check_handle_), nullptr);
+        uv_close(reinterpret_cast<uv_handle_t*>(&idle_handle_), nullptr);
+        enabled_ = false;
+        idling_ = false;
+    }
+    
+    //
+    // EventLoop
+    //
+    
     EventLoop::EventLoop(uv_loop_t* handle) : handle_(handle) {
+        nextTick.attach(handle_);
     };
     
     EventLoop::EventLoop() : EventLoop(uv_loop_new()) {
@@ -42,12 +126,18 @@ namespace ngn{
         return uv_run(handle_, mode);
     }
     
+    int EventLoop::runWithTick() {
+        nextTick.drain();
+        return run();
+    }
+    
     uv_loop_t* EventLoop::handle() const {
         return handle_;
     };
     
     EventLoop::~EventLoop() {
         if (handle_ != nullptr) {
+            nextTick.close();
             uv_run(handle_, UV_RUN_NOWAIT);
             uv_loop_delete(handle_);
             handle_ = nullptr;
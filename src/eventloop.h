@@ -13,7 +13,10 @@
 #include <vector>
 #include "event.h"
 #include "optional.h"
+#include "small_task.h"
 #include <unordered_map>
+#include <memory>
+#include <cstdint>
 
 namespace ngn {
     
@@ -24,6 +27,73 @@ namespace ngn {
     
 
     typedef uv_run_mode RunMode;
+    
+    //
+    // Microtask queue for an EventLoop
+    //
+    // Callbacks queued with nextTick(fn) run once the current callback has
+    // returned: a check handle drains the queue right after the poll phase
+    // and an idle handle keeps poll from blocking while anything is queued.
+    // Callbacks queued while draining run in the same pass, up to
+    // max_per_iteration, the rest wait for the next iteration so timers and
+    // I/O still get a turn. Storage is a ring that only grows, so a steady
+    // stream of ticks doesn't allocate
+    //
+    class TickQueue {
+        static void on_check(uv_check_t* handle, int status);
+        static void on_idle(uv_idle_t* handle, int status);
+    public:
+        typedef small_task callback;
+        static const size_t default_max_per_iteration = 1024;
+        
+        TickQueue();
+        TickQueue(const TickQueue&) = delete;
+        TickQueue& operator=(const TickQueue&) = delete;
+        
+        void attach(uv_loop_t* loop) {
+            loop_ = loop;
+        }
+        
+        void push(callback fn);
+        void operator()(callback fn) {
+            push(std::move(fn));
+        }
+        
+        // runs up to limit callbacks, returns true if any are left
+        bool drain(size_t limit = SIZE_MAX);
+        
+        size_t size() const {
+            return tail_ - head_;
+        }
+        bool empty() const {
+            return head_ == tail_;
+        }
+        size_t max_per_iteration() const {
+            return max_per_iteration_;
+        }
+        void max_per_iteration(size_t limit) {
+            max_per_iteration_ = limit ? limit : 1;
+        }
+        
+        // closes the handles, the loop has to run once more to finish
+        void close();
+        
+    private:
+        void grow();
+        void enable();
+        
+        uv_loop_t* loop_;
+        std::unique_ptr<callback[]> ring_;
+        size_t mask_;
+        size_t head_;
+        size_t tail_;
+        size_t max_per_iteration_;
+        uv_check_t check_handle_;
+        uv_idle_t idle_handle_;
+        bool enabled_;
+        bool idling_;
+    };
+    
     class EventLoop {
 public:
         static EventLoop& default_loop();
@@ -32,10 +102,11 @@ public:
         EventLoop(uv_loop_t* handle);
         EventLoop(const EventLoop& that) {
             handle_ = that.handle_;
+            nextTick.attach(handle_);
         }
         ~EventLoop();
         
-        typedef Event<> TickEvent;
+        typedef TickQueue TickEvent;
         TickEvent nextTick;
         
         template<class Type> Type* data() {
@@ -47,12 +118,11 @@ public:
 
         int run(RunMode mode);
         int run();
+        // runs what's already queued on nextTick before entering the loop
         int runWithTick();
         void stop();
         unsigned int active_handles();
         uv_loop_t* handle() const;
-        uv_idle_t tick_handle_;
-        bool tick_enabled_ = false;
         int fd();
         friend class Timer;
         friend class Idler;
@@ -0,0 +1,213 @@
+//
+//  executor.cpp
+//  ngn
+//
+//
+//
+
+#include "executor.h"
+#include "isolate.h"
+#include "handle.h"
+
+#include <deque>
+
+namespace ngn {
+    struct executor::task_node {
+        small_task work;
+        small_task done;
+        isolate* origin;
+    };
+
+    class executor::worker {
+    public:
+        spinlock lock;
+        std::deque<task_node*> tasks;
+        std::thread thread;
+    };
+
+    namespace {
+        // the pool and worker the current thread belongs to, tasks it
+        // submits stay on its own deque
+        thread_local const executor* current_owner = nullptr;
+        thread_local size_t current_index = 0;
+    }
+
+    //
+    // Construction
+    //
+
+    executor::executor(size_t threads) :
+        m_next(0),
+        m_queued(0),
+        m_sleepers(0),
+        m_stopping(false) {
+        if (threads == 0)
+            threads = 1;
+        m_workers.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+            m_workers.emplace_back(new worker());
+        // start only once the vector is complete, thieves walk all of it
+        for (size_t i = 0; i < threads; ++i)
+            m_workers[i]->thread = std::thread([this, i] { run(i); });
+    };
+
+    executor::~executor() {
+        {
+            std::lock_guard<std::mutex> lock(m_sleep_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (auto& w : m_workers)
+            w->thread.join();
+        for (auto node : m_free)
+            delete node;
+    };
+
+    executor& executor::shared() {
+        static executor instance;
+        return instance;
+    };
+
+    //
+    // Submission
+    //
+
+    void executor::submit(small_task work) {
+        task_node* node = acquire();
+        node->work = std::move(work);
+        node->origin = nullptr;
+        push(node);
+    };
+
+    void executor::submit(small_task work, small_task done) {
+        submit(std::move(work), std::move(done), isolate::instance());
+    };
+
+    void executor::submit(small_task work, small_task done, isolate& origin) {
+        task_node* node = acquire();
+        node->work = std::move(work);
+        node->done = std::move(done);
+        node->origin = &origin;
+        // also creates the sink on this (the loop) thread
+        origin.add_pending();
+        push(node);
+    };
+
+    //
+    // Node Pool
+    //
+
+    executor::task_node* executor::acquire() {
+        {
+            std::lock_guard<spinlock> lock(m_free_lock);
+            if (!m_free.empty()) {
+                task_node* node = m_free.back();
+                m_free.pop_back();
+                return node;
+            }
+        }
+        return new task_node();
+    };
+
+    void executor::recycle(task_node* node) {
+        node->work = nullptr;
+        node->done = nullptr;
+        node->origin = nullptr;
+        std::lock_guard<spinlock> lock(m_free_lock);
+        m_free.push_back(node);
+    };
+
+    //
+    // Scheduling
+    //
+
+    void executor::push(task_node* node) {
+        size_t index;
+        if (current_owner == this)
+            index = current_index;
+        else
+            index = m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+        // counted before it's visible so whoever pops it never takes the
+        // count below zero, a worker woken early just looks again
+        m_queued.fetch_add(1);
+        {
+            worker& target = *m_workers[index];
+            std::lock_guard<spinlock> lock(target.lock);
+            target.tasks.push_back(node);
+        }
+        // a sleeper bumps m_sleepers before its last look at m_queued, so
+        // one of us always sees the other
+        if (m_sleepers.load() != 0) {
+            std::lock_guard<std::mutex> lock(m_sleep_mutex);
+            m_wake.notify_one();
+        }
+    };
+
+    executor::task_node* executor::steal(size_t thief) {
+        size_t count = m_workers.size();
+        for (size_t i = 1; i < count; ++i) {
+            worker& victim = *m_workers[(thief + i) % count];
+            std::lock_guard<spinlock> lock(victim.lock);
+            if (!victim.tasks.empty()) {
+                task_node* node = victim.tasks.front();
+                victim.tasks.pop_front();
+                return node;
+            }
+        }
+        return nullptr;
+    };
+
+    void executor::run(size_t index) {
+        worker& self = *m_workers[index];
+        current_owner = this;
+        current_index = index;
+        for (;;) {
+            task_node* node = nullptr;
+            {
+                std::lock_guard<spinlock> lock(self.lock);
+                if (!self.tasks.empty()) {
+                    node = self.tasks.back();
+                    self.tasks.pop_back();
+                }
+            }
+            if (node == nullptr)
+                node = steal(index);
+            if (node) {
+                m_queued.fetch_sub(1);
+                execute(node);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_sleep_mutex);
+            m_sleepers.fetch_add(1);
+            m_wake.wait(lock, [this] { return m_queued.load() != 0 || m_stopping; });
+            m_sleepers.fetch_sub(1);
+            if (m_stopping && m_queued.load() == 0)
+                break;
+        }
+        current_owner = nullptr;
+    };
+
+    //
+    // Execution
+    //
+
+    void executor::execute(task_node* node) {
+        node->work();
+        if (node->origin == nullptr) {
+            recycle(node);
+            return;
+        }
+        // the node rides along so the sink's callback stays small enough
+        // not to allocate
+        node->origin->messages().post([this, node] { complete(node); });
+    };
+
+    void executor::complete(task_node* node) {
+        isolate* origin = node->origin;
+        if (node->done)
+            node->done();
+        recycle(node);
+        origin->remove_pending();
+    };
+}
@@ -0,0 +1,101 @@
+//
+//  executor.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__executor__
+#define __ngn__executor__
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "small_task.h"
+
+namespace ngn {
+    class isolate;
+
+    //
+    // Thread pool for CPU work that shouldn't block a loop
+    //
+    // Every worker has its own deque: it pushes and pops at the back (so
+    // tasks spawned from a task stay hot in its cache) and idle workers
+    // steal from the front of the others. Tasks are small_tasks held in
+    // recycled nodes, so submitting doesn't allocate once the pool is warm.
+    //
+    // A completion runs on the loop of the isolate that submitted the work,
+    // through the isolate's message sink, and keeps that loop alive until
+    // it has run. The executor has to outlive the completions it delivers
+    //
+    class executor {
+    public:
+        explicit executor(size_t threads = std::thread::hardware_concurrency());
+        executor(const executor&) = delete;
+        executor& operator=(const executor&) = delete;
+        // finishes everything queued, then joins
+        ~executor();
+
+        // process-wide pool sized to the machine
+        static executor& shared();
+
+        size_t size() const {
+            return m_workers.size();
+        };
+
+        // runs work on a pool thread
+        void submit(small_task work);
+
+        // runs work on a pool thread, then done on origin's loop thread
+        // has to be called from origin's loop thread
+        void submit(small_task work, small_task done);
+        void submit(small_task work, small_task done, isolate& origin);
+
+    private:
+        struct task_node;
+        class worker;
+
+        class spinlock {
+        public:
+            spinlock() {
+                m_flag.clear();
+            };
+            void lock() {
+                while (m_flag.test_and_set(std::memory_order_acquire))
+                    std::this_thread::yield();
+            };
+            void unlock() {
+                m_flag.clear(std::memory_order_release);
+            };
+        private:
+            std::atomic_flag m_flag;
+        };
+
+        task_node* acquire();
+        void recycle(task_node* node);
+        void push(task_node* node);
+        task_node* steal(size_t thief);
+        void execute(task_node* node);
+        void complete(task_node* node);
+        void run(size_t index);
+
+        std::vector<std::unique_ptr<worker>> m_workers;
+        std::atomic<size_t> m_next;
+
+        // sleeping workers
+        std::atomic<size_t> m_queued;
+        std::atomic<size_t> m_sleepers;
+        std::atomic<bool> m_stopping;
+        std::mutex m_sleep_mutex;
+        std::condition_variable m_wake;
+
+        // recycled nodes
+        spinlock m_free_lock;
+        std::vector<task_node*> m_free;
+    };
+}
+
+#endif /* defined(__ngn__executor__) */
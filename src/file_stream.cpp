@@ -0,0 +1,263 @@
+//
+//  file_stream.cpp
+//  ngn
+//
+//
+//
+
+#include "file_stream.h"
+#include <algorithm>
+#include <stdexcept>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <cerrno>
+#endif
+
+namespace ngn {
+    //
+    // Construction
+    //
+
+    FileReadStream::FileReadStream(uv_file fd, int64_t start, int64_t length,
+                                   size_type chunk_size, size_type readahead, isolate& isolate) :
+        ReadableStream(chunk_size),
+        m_isolate(isolate),
+        m_fs(isolate),
+        m_fd(fd),
+        m_position(start),
+        m_remaining(length),
+        m_chunk_size(chunk_size),
+        m_read_size(chunk_size),
+        m_readahead(std::max<size_type>(readahead, 1)),
+        m_exhausted(false),
+        m_finished(false),
+        m_dest(nullptr),
+        m_out(-1),
+        m_send_size(0),
+        m_send_result(0),
+        m_end_dest(true),
+        m_sent_any(false),
+        m_no_sendfile(false) {
+        m_req.data = this;
+        m_work.data = this;
+    };
+
+    FileReadStream::~FileReadStream() {
+    };
+
+    FileReadStream::size_type FileReadStream::limit(size_type count) const {
+        if (m_remaining < 0)
+            return count;
+        return std::min<size_type>(count, static_cast<size_type>(m_remaining));
+    };
+
+    //
+    // Reads
+    //
+
+    void FileReadStream::_read(size_type count) {
+        m_read_size = std::max(count, m_chunk_size);
+        fill();
+    };
+    
+    void FileReadStream::fill() {
+        while (!m_exhausted && m_reads.size() < m_readahead) {
+            size_type size = limit(m_read_size);
+            if (size == 0)
+                m_exhausted = true;
+            else
+                issue(size);
+        }
+        endMaybe();
+    };
+    
+    void FileReadStream::issue(size_type size) {
+        m_reads.push_back(pending_read{m_isolate.buffer_pool().acquire(size), size, 0, false});
+        pending_read& pending = m_reads.back();
+        int64_t offset = m_position;
+        m_position += size;
+        if (m_remaining > 0)
+            m_remaining -= size;
+        m_fs.read(m_fd, pending.chunk, offset, [this, &pending](ssize_t result) {
+            pending.result = result;
+            pending.done = true;
+            deliver();
+        });
+    };
+    
+    void FileReadStream::deliver() {
+        bool more = true;
+        while (!m_reads.empty() && m_reads.front().done) {
+            pending_read pending(std::move(m_reads.front()));
+            m_reads.pop_front();
+            if (m_finished)
+                continue;
+            if (pending.result < 0) {
+                m_finished = m_exhausted = true;
+                fail(static_cast<int>(pending.result));
+                continue;
+            }
+            if (pending.result > 0) {
+                pending.chunk.trim_end(pending.chunk.size() - pending.result);
+                more = push(std::move(pending.chunk));
+            }
+            // the reads behind this one started past the end of the file
+            if (static_cast<size_type>(pending.result) < pending.size) {
+                m_finished = m_exhausted = true;
+                push(nullopt);
+            }
+        }
+        if (more)
+            fill();
+        else
+            endMaybe();
+    };
+    
+    void FileReadStream::endMaybe() {
+        if (m_exhausted && m_reads.empty() && !m_finished) {
+            m_finished = true;
+            push(nullopt);
+        }
+    };
+    
+    void FileReadStream::fail(int status) {
+        onError(std::runtime_error(uv_strerror(status)));
+    };
+
+    //
+    // sendfile
+    //
+
+    bool FileReadStream::_pipe(writable_type& dest, bool end) {
+        if (m_no_sendfile || m_dest != nullptr)
+            return false;
+        // sendfile() starts at m_position, whatever was read ahead of it
+        // has to go through the stream
+        if (!m_reads.empty() || length() > 0)
+            return false;
+        uv_file out = dest._fileno();
+        if (out < 0)
+            return false;
+        m_dest = &dest;
+        m_out = out;
+        m_end_dest = end;
+        m_sent_any = false;
+        if (dest.length() == 0) {
+            send();
+        } else {
+            // earlier writes have to hit the socket first, an empty write
+            // completes right after them
+            dest.write(experimental::Buffer(), [this](int status) {
+                if (status < 0)
+                    finish(status);
+                else
+                    send();
+            });
+        }
+        return true;
+    };
+
+    void FileReadStream::send() {
+        size_type size = limit(max_send_size);
+        if (size == 0) {
+            finish(0);
+            return;
+        }
+        m_send_size = size;
+#ifdef __linux__
+        // uv_fs_sendfile may try copy_file_range first and then emulate
+        // sendfile with reads and writes that block on a full socket, so
+        // make the call ourselves
+        int result = uv_queue_work(m_isolate.event_loop().handle(), &m_work, sendfile_work, after_sendfile);
+#else
+        int result = uv_fs_sendfile(m_isolate.event_loop().handle(), &m_req, m_out, m_fd, m_position, size, on_sendfile);
+#endif
+        if (result < 0)
+            finish(result);
+    };
+
+    void FileReadStream::sendfile_work(uv_work_t* req) {
+#ifdef __linux__
+        auto self = static_cast<FileReadStream*>(req->data);
+        off_t offset = self->m_position;
+        ssize_t result = ::sendfile(self->m_out, self->m_fd, &offset, self->m_send_size);
+        self->m_send_result = result < 0 ? -errno : result;
+#endif
+    };
+
+    void FileReadStream::after_sendfile(uv_work_t* req, int status) {
+        auto self = static_cast<FileReadStream*>(req->data);
+        self->sent(status < 0 ? status : self->m_send_result);
+    };
+
+    void FileReadStream::on_sendfile(uv_fs_t* req) {
+        auto self = static_cast<FileReadStream*>(req->data);
+        ssize_t result = req->result;
+        uv_fs_req_cleanup(req);
+        self->sent(result);
+    };
+
+    void FileReadStream::sent(ssize_t result) {
+        if (result > 0) {
+            m_sent_any = true;
+            m_position += result;
+            if (m_remaining > 0)
+                m_remaining -= result;
+            send();
+        } else if (result == 0) {
+            finish(0);
+        } else if (result == UV_EAGAIN) {
+            probe();
+        } else if (!m_sent_any && (result == UV_EINVAL || result == UV_ENOSYS || result == UV_ENOTSUP)) {
+            // this pair of descriptors can't do sendfile, read and write
+            writable_type& dest = *m_dest;
+            m_dest = nullptr;
+            m_no_sendfile = true;
+            pipe(dest, m_end_dest);
+        } else {
+            finish(static_cast<int>(result));
+        }
+    };
+
+    // the socket is full: one chunk goes through the regular write, which
+    // waits for the socket to drain, after that sendfile() takes over again
+    void FileReadStream::probe() {
+        experimental::Buffer chunk = m_isolate.buffer_pool().acquire(limit(m_chunk_size));
+        m_fs.read(m_fd, chunk, m_position, [this, chunk](ssize_t result) mutable {
+            if (result <= 0) {
+                finish(static_cast<int>(result));
+                return;
+            }
+            m_sent_any = true;
+            m_position += result;
+            if (m_remaining > 0)
+                m_remaining -= result;
+            chunk.trim_end(chunk.size() - result);
+            m_dest->write(std::move(chunk), [this](int status) {
+                if (m_dest == nullptr)
+                    return;
+                if (status < 0)
+                    finish(status);
+                else
+                    send();
+            });
+        });
+    };
+    
+    void FileReadStream::finish(int status) {
+        writable_type& dest = *m_dest;
+        m_dest = nullptr;
+        if (status < 0) {
+            std::runtime_error error(uv_strerror(status));
+            onError(std::runtime_error(error));
+            dest.onError(std::runtime_error(error));
+            return;
+        }
+        // nothing was buffered, so this ends the readable side right away
+        m_finished = m_exhausted = true;
+        push(nullopt);
+        read(0);
+        if (m_end_dest)
+            dest.end();
+    };
+}
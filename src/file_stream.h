@@ -0,0 +1,167 @@
+//
+//  file_stream.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__file_stream__
+#define __ngn__file_stream__
+
+#include <uv.h>
+#include <cstdint>
+#include <deque>
+#include "stream.h"
+#include "handle.h"
+#include "filesystem.h"
+
+namespace ngn {
+    //
+    // Reads a file descriptor as a stream of Buffers from the isolate's pool
+    //
+    // Up to readahead positional reads are kept in flight through
+    // FileSystem, so the disk always has the next chunks queued while
+    // the current one is consumed. They're pushed in file order, and no
+    // new reads are issued while the stream is above its high water mark,
+    // which bounds memory to about high_water_mark + readahead chunks.
+    // A short read ends the stream.
+    //
+    // Piped into a writable that sits on a socket (see StreamWrapWritable)
+    // the bytes never reach userspace: the file is pushed with sendfile()
+    // from the libuv threadpool, since it may block on the disk. When the
+    // socket is full sendfile() gives EAGAIN, then one chunk goes through
+    // the socket's regular write path, whose completion tells us there is
+    // room again. Anything sendfile() can't handle falls back to reading
+    // and writing chunks.
+    //
+    // The descriptor isn't closed by the stream. The stream has to stay
+    // alive while a read or a send is in flight, and nothing else should
+    // write to the destination until the file has been sent
+    //
+    class FileReadStream : public ReadableStream<experimental::Buffer> {
+        static void on_sendfile(uv_fs_t* req);
+        static void sendfile_work(uv_work_t* req);
+        static void after_sendfile(uv_work_t* req, int status);
+    public:
+        static const size_type default_chunk_size = 64 * 1024;
+        // reads kept in flight
+        static const size_type default_readahead = 4;
+        // bytes per sendfile() call, one call holds a threadpool thread
+        static const size_type max_send_size = 4 * 1024 * 1024;
+
+        // streams length bytes from start, or everything up to EOF
+        explicit FileReadStream(uv_file fd, int64_t start = 0, int64_t length = -1,
+                                size_type chunk_size = default_chunk_size,
+                                size_type readahead = default_readahead,
+                                isolate& isolate = isolate::instance());
+        ~FileReadStream();
+
+        uv_file fd() const {
+            return m_fd;
+        };
+        // offset of the next read to be issued
+        int64_t position() const {
+            return m_position;
+        };
+
+    protected:
+        void _read(size_type count) override;
+        bool _pipe(writable_type& dest, bool end) override;
+
+    private:
+        struct pending_read {
+            experimental::Buffer chunk;
+            // bytes asked for, fewer means end of file
+            size_type size;
+            ssize_t result;
+            bool done;
+        };
+        
+        // bytes left to hand out for a request of count
+        size_type limit(size_type count) const;
+        // tops the reads in flight up to m_readahead
+        void fill();
+        void issue(size_type size);
+        // pushes the reads that completed, in file order
+        void deliver();
+        void endMaybe();
+        void send();
+        void sent(ssize_t result);
+        void probe();
+        void finish(int status);
+        void fail(int status);
+
+        isolate& m_isolate;
+        FileSystem m_fs;
+        uv_fs_t m_req;
+        uv_work_t m_work;
+        uv_file m_fd;
+        int64_t m_position;
+        // bytes not asked for yet, -1 reads to EOF
+        int64_t m_remaining;
+        size_type m_chunk_size;
+        size_type m_read_size;
+        size_type m_readahead;
+        // oldest first, references stay valid while reads are appended
+        std::deque<pending_read> m_reads;
+        // no more reads will be issued
+        bool m_exhausted;
+        // EOF or an error was pushed, late reads are dropped
+        bool m_finished;
+
+        // sendfile state
+        writable_type* m_dest;
+        uv_file m_out;
+        size_type m_send_size;
+        // set on the threadpool, read in after_sendfile
+        ssize_t m_send_result;
+        bool m_end_dest;
+        bool m_sent_any;
+        // sendfile() failed, pipe() takes the read/write route
+        bool m_no_sendfile;
+    };
+
+    //
+    // WritableStream on top of a StreamWrap (tcp, pipe, tty)
+    //
+    // Chunks go to StreamWrap::write, corked or queued chunks are handed
+    // over as one BufferQueue so they leave in a single writev
+    //
+    template <class T>
+    class StreamWrapWritable : public WritableStream<experimental::Buffer> {
+    public:
+        typedef StreamWrap<T> stream_type;
+
+        explicit StreamWrapWritable(stream_type& stream,
+                                    size_type high_water_mark = traits_type::high_water_mark) :
+            WritableStream(high_water_mark),
+            m_stream(stream) {};
+
+        stream_type& stream() {
+            return m_stream;
+        };
+
+        uv_file _fileno() override {
+            uv_os_fd_t fd;
+            if (uv_fileno(&static_cast<uv_handle_t&>(m_stream), &fd) < 0)
+                return -1;
+            return fd;
+        };
+
+    protected:
+        void _write(chunk_type chunk, write_callback cb) override {
+            m_stream.write(chunk, std::move(cb));
+        };
+        void _writev(chunk_list chunks, write_callback cb) override {
+            experimental::BufferQueue queue;
+            for (auto& chunk : chunks)
+                queue.append(std::move(chunk));
+            m_stream.write(std::move(queue), std::move(cb));
+        };
+
+    private:
+        stream_type& m_stream;
+    };
+}
+
+#endif /* defined(__ngn__file_stream__) */
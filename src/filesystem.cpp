@@ -7,3 +7,413 @@
 //
 
 #include "filesystem.h"
+#include "hex.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ngn {
+    namespace {
+        // releases a mapping once its last Buffer is gone
+        struct unmapper {
+            size_t length;
+            void operator()(experimental::byte* base) const noexcept {
+                munmap(base, length);
+            }
+        };
+        
+        std::system_error system_error(int code, const string& what) {
+            return std::system_error(code, std::generic_category(), what);
+        }
+        
+        std::runtime_error uv_error(ssize_t status) {
+            return std::runtime_error(uv_strerror(static_cast<int>(status)));
+        }
+        
+        struct read_file_state {
+            FileSystem::Encoding encoding;
+            FileSystem::readStringCallback callback;
+            FileSystem::FileHandle fd;
+            experimental::Buffer chunk;
+            string contents;
+        };
+        
+        struct write_file_state {
+            FileSystem::writeFileCallback callback;
+            FileSystem::FileHandle fd;
+            // what's left to write, starting at offset
+            experimental::Buffer data;
+            int64_t offset;
+        };
+        
+        // the descriptor is closed whatever happened, the first error wins
+        void finish_read(FileSystem& fs, std::shared_ptr<read_file_state> state, ssize_t status) {
+            fs.close(state->fd, [state, status](ssize_t closed) {
+                ssize_t error = status < 0 ? status : closed;
+                if (error < 0) {
+                    state->callback(uv_error(error), string());
+                    return;
+                }
+                if (state->encoding == FileSystem::Hex) {
+                    string hex(state->contents.size() * 2, '\0');
+                    hex_encode(state->contents.data(), state->contents.size(), &hex[0], hex.size());
+                    state->callback(std::exception(), std::move(hex));
+                } else {
+                    state->callback(std::exception(), std::move(state->contents));
+                }
+            });
+        }
+        
+        void read_next(FileSystem& fs, std::shared_ptr<read_file_state> state) {
+            // the size from fstat may be stale or 0 (procfs), read until EOF
+            fs.read(state->fd, state->chunk, static_cast<int64_t>(state->contents.size()),
+                    [&fs, state](ssize_t result) {
+                if (result <= 0) {
+                    finish_read(fs, std::move(state), result);
+                    return;
+                }
+                state->contents.append(reinterpret_cast<const char*>(state->chunk.data()), result);
+                read_next(fs, std::move(state));
+            });
+        }
+        
+        void finish_write(FileSystem& fs, std::shared_ptr<write_file_state> state, ssize_t status) {
+            fs.close(state->fd, [state, status](ssize_t closed) {
+                ssize_t error = status < 0 ? status : closed;
+                if (!state->callback)
+                    return;
+                if (error < 0)
+                    state->callback(uv_error(error));
+                else
+                    state->callback(std::exception());
+            });
+        }
+        
+        void write_next(FileSystem& fs, std::shared_ptr<write_file_state> state) {
+            if (state->data.empty()) {
+                finish_write(fs, std::move(state), 0);
+                return;
+            }
+            fs.write(state->fd, state->data, state->offset, [&fs, state](ssize_t result) {
+                if (result < 0) {
+                    finish_write(fs, std::move(state), result);
+                    return;
+                }
+                // short writes carry on where they stopped
+                state->offset += result;
+                state->data.trim_start(result);
+                write_next(fs, std::move(state));
+            });
+        }
+    }
+    
+    //
+    // Memory Mapping
+    //
+    
+    experimental::Buffer FileSystem::map(const string& path, int advice) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw system_error(errno, "open " + path);
+        struct stat info;
+        if (::fstat(fd, &info) < 0) {
+            int code = errno;
+            ::close(fd);
+            throw system_error(code, "fstat " + path);
+        }
+        size_t length = static_cast<size_t>(info.st_size);
+        // mmap() refuses empty mappings
+        if (length == 0) {
+            ::close(fd);
+            return experimental::Buffer();
+        }
+        void* base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        int code = errno;
+        // the mapping keeps the file open by itself
+        ::close(fd);
+        if (base == MAP_FAILED)
+            throw system_error(code, "mmap " + path);
+        
+        experimental::Buffer buffer(static_cast<const experimental::byte*>(base), 0, length,
+                                    experimental::Buffer::take_ownership, unmapper{length},
+                                    experimental::Buffer::read_only);
+        advise(buffer, advice);
+        return buffer;
+    };
+    
+    void FileSystem::advise(const experimental::Buffer& buffer, int advice) {
+        if (buffer.empty())
+            return;
+        // madvise wants page aligned ranges, slices may start anywhere
+        uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        uintptr_t begin = reinterpret_cast<uintptr_t>(buffer.data()) & ~(page - 1);
+        uintptr_t end = reinterpret_cast<uintptr_t>(buffer.data()) + buffer.size();
+        void* address = reinterpret_cast<void*>(begin);
+        size_t length = end - begin;
+        // hints are best effort, the kernel is free to ignore them
+        if (advice & Sequential)
+            madvise(address, length, MADV_SEQUENTIAL);
+        if (advice & Random)
+            madvise(address, length, MADV_RANDOM);
+        if (advice & WillNeed)
+            madvise(address, length, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        if (advice & HugePage)
+            madvise(address, length, MADV_HUGEPAGE);
+#endif
+    };
+    
+    //
+    // Requests
+    //
+    
+    class FileSystem::Request : public uv_fs_t, public uring::request {
+    public:
+        explicit Request(FileSystem* filesystem) : filesystem(filesystem) {}
+        FileSystem* filesystem;
+        // keep the memory alive until the request completes
+        experimental::Buffer buffer;
+        experimental::BufferQueue buffers;
+        std::vector<uv_buf_t> bufs;
+        resultCallback callback;
+        statCallback stat_callback;
+    };
+    
+    const size_t FileSystem::max_free_requests;
+    const size_t FileSystem::read_chunk_size;
+    const size_t FileSystem::max_read_chunk_size;
+    
+    FileSystem::FileSystem(isolate& isolate) : m_isolate(isolate) {
+    };
+    
+    FileSystem::~FileSystem() {
+        for (auto req : m_free_requests)
+            delete req;
+    };
+    
+    uv_loop_t* FileSystem::loop() {
+        return m_isolate.event_loop().handle();
+    };
+    
+    FileSystem::Request* FileSystem::acquire() {
+        if (m_free_requests.empty())
+            return new Request(this);
+        Request* req = m_free_requests.back();
+        m_free_requests.pop_back();
+        return req;
+    };
+    
+    void FileSystem::recycle(Request* req) {
+        req->buffer = experimental::Buffer();
+        req->buffers.clear();
+        req->callback = nullptr;
+        req->stat_callback = nullptr;
+        if (m_free_requests.size() < max_free_requests)
+            m_free_requests.push_back(req);
+        else
+            delete req;
+    };
+    
+    void FileSystem::reject(Request* req, int status) {
+        m_isolate.event_loop().nextTick([req, status] {
+            req->result = status;
+            if (req->stat_callback)
+                on_stat(req);
+            else
+                on_result(req);
+        });
+    };
+    
+    // the request goes back to the pool before the callback runs, so the
+    // callback can issue the next one with it
+    void FileSystem::on_result(uv_fs_t* handle) {
+        auto req = static_cast<Request*>(handle);
+        ssize_t result = req->result;
+        uv_fs_req_cleanup(req);
+        complete(req, result);
+    };
+    
+    void FileSystem::on_ring(uring::request* handle, ssize_t result) {
+        complete(static_cast<Request*>(handle), result);
+    };
+    
+    void FileSystem::complete(Request* req, ssize_t result) {
+        resultCallback callback(std::move(req->callback));
+        req->filesystem->recycle(req);
+        if (callback)
+            callback(result);
+    };
+    
+    void FileSystem::on_stat(uv_fs_t* handle) {
+        auto req = static_cast<Request*>(handle);
+        int status = static_cast<int>(req->result);
+        uv_stat_t stat = req->statbuf;
+        uv_fs_req_cleanup(req);
+        statCallback callback(std::move(req->stat_callback));
+        req->filesystem->recycle(req);
+        if (callback)
+            callback(status, stat);
+    };
+    
+    //
+    // Descriptors
+    //
+    
+    void FileSystem::open(const string& path, int flags, int mode, resultCallback callback) {
+        Request* req = acquire();
+        req->callback = std::move(callback);
+        int result = uv_fs_open(loop(), req, path.c_str(), flags, mode, on_result);
+        if (result < 0)
+            reject(req, result);
+    };
+    
+    void FileSystem::close(FileHandle fd, resultCallback callback) {
+        Request* req = acquire();
+        req->callback = std::move(callback);
+        int result = uv_fs_close(loop(), req, fd, on_result);
+        if (result < 0)
+            reject(req, result);
+    };
+    
+    void FileSystem::fstat(FileHandle fd, statCallback callback) {
+        Request* req = acquire();
+        req->stat_callback = std::move(callback);
+        int result = uv_fs_fstat(loop(), req, fd, on_stat);
+        if (result < 0)
+            reject(req, result);
+    };
+    
+    //
+    // Positional I/O
+    //
+    
+    void FileSystem::read(FileHandle fd, experimental::Buffer& buffer, int64_t offset, resultCallback callback) {
+        Request* req = acquire();
+        req->buffer = buffer;
+        req->callback = std::move(callback);
+        req->bufs.assign(1, req->buffer);
+        transfer(req, fd, offset, false);
+    };
+    
+    void FileSystem::write(FileHandle fd, const experimental::Buffer& buffer, int64_t offset, resultCallback callback) {
+        Request* req = acquire();
+        req->buffer = buffer;
+        req->callback = std::move(callback);
+        req->bufs.assign(1, req->buffer);
+        transfer(req, fd, offset, true);
+    };
+    
+    void FileSystem::readv(FileHandle fd, experimental::BufferQueue& buffers, int64_t offset, resultCallback callback) {
+        Request* req = acquire();
+        req->buffers = buffers;
+        req->callback = std::move(callback);
+        req->bufs.resize(req->buffers.chunk_count());
+        req->buffers.iovec(req->bufs.data(), req->bufs.size());
+        transfer(req, fd, offset, false);
+    };
+    
+    void FileSystem::writev(FileHandle fd, const experimental::BufferQueue& buffers, int64_t offset, resultCallback callback) {
+        Request* req = acquire();
+        req->buffers = buffers;
+        req->callback = std::move(callback);
+        req->bufs.resize(req->buffers.chunk_count());
+        req->buffers.iovec(req->bufs.data(), req->bufs.size());
+        transfer(req, fd, offset, true);
+    };
+    
+    void FileSystem::transfer(Request* req, FileHandle fd, int64_t offset, bool write) {
+        if (submit(req, fd, offset, write))
+            return;
+        unsigned int nbufs = static_cast<unsigned int>(req->bufs.size());
+        int result = write
+            ? uv_fs_write(loop(), req, fd, req->bufs.data(), nbufs, offset, on_result)
+            : uv_fs_read(loop(), req, fd, req->bufs.data(), nbufs, offset, on_result);
+        if (result < 0)
+            reject(req, result);
+    };
+    
+    bool FileSystem::submit(Request* req, FileHandle fd, int64_t offset, bool write) {
+        uring* ring = m_isolate.io_uring();
+        if (ring == nullptr)
+            return false;
+        req->on_complete = on_ring;
+        unsigned nbufs = static_cast<unsigned>(req->bufs.size());
+        return write
+            ? ring->writev(fd, req->bufs.data(), nbufs, offset, req)
+            : ring->readv(fd, req->bufs.data(), nbufs, offset, req);
+    };
+    
+    //
+    // Whole Files
+    //
+    
+    void FileSystem::openFile(string fileName, openFileCallback callback) {
+        open(fileName, O_RDONLY | O_CLOEXEC, 0, [callback](ssize_t fd) {
+            if (fd < 0)
+                callback(uv_error(fd), -1);
+            else
+                callback(std::exception(), static_cast<FileHandle>(fd));
+        });
+    };
+    
+    void FileSystem::readFile(string fileName, Encoding encoding, readStringCallback callback) {
+        auto state = std::make_shared<read_file_state>();
+        state->encoding = encoding;
+        state->callback = std::move(callback);
+        open(fileName, O_RDONLY | O_CLOEXEC, 0, [this, state](ssize_t fd) {
+            if (fd < 0) {
+                state->callback(uv_error(fd), string());
+                return;
+            }
+            state->fd = static_cast<FileHandle>(fd);
+            fstat(state->fd, [this, state](int status, const uv_stat_t& stat) {
+                if (status < 0) {
+                    finish_read(*this, std::move(state), status);
+                    return;
+                }
+                state->contents.reserve(stat.st_size);
+                state->chunk = m_isolate.buffer_pool().acquire(
+                    std::max<size_t>(std::min<size_t>(stat.st_size, max_read_chunk_size), read_chunk_size));
+                read_next(*this, std::move(state));
+            });
+        });
+    };
+    
+    void FileSystem::writeFile(string fileName, Encoding encoding, const char* buffer, size_t length,
+                               writeFileCallback callback) {
+        writeFile(std::move(fileName), encoding, buffer, 0, length, std::move(callback));
+    };
+    
+    void FileSystem::writeFile(string fileName, Encoding encoding, const char* buffer, size_t offset, size_t length,
+                               writeFileCallback callback) {
+        auto state = std::make_shared<write_file_state>();
+        state->callback = std::move(callback);
+        state->offset = 0;
+        // the caller's memory is only good for this call
+        const char* source = buffer + offset;
+        if (encoding == Hex) {
+            state->data = experimental::Buffer(length / 2);
+            size_t size = hex_decode(reinterpret_cast<char*>(state->data.data()), length / 2, source, length);
+            state->data.trim_end(state->data.size() - size);
+        } else if (length > 0) {
+            state->data = experimental::Buffer(length);
+            std::memcpy(state->data.data(), source, length);
+        }
+        open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644, [this, state](ssize_t fd) {
+            if (fd < 0) {
+                if (state->callback)
+                    state->callback(uv_error(fd));
+                return;
+            }
+            state->fd = static_cast<FileHandle>(fd);
+            write_next(*this, std::move(state));
+        });
+    };
+}
@@ -10,11 +10,35 @@
 #define __uv__filesystem__
 #include <string>
 #include <functional>
+#include <vector>
+#include <uv.h>
+#include "io_buffer.h"
+#include "buffer_queue.h"
+#include "inplace_function.h"
+#include "isolate.h"
+#include "uring.h"
 
 namespace ngn{
     using std::string;
     
+    //
+    // Asynchronous file access on top of uv_fs_*
+    //
+    // Every call completes on the loop thread, after it has returned. The
+    // uv_fs_t requests come from a small free list, and reads and writes
+    // work on the caller's Buffers, which stay referenced until the
+    // request completes, so a read can land straight in pooled memory.
+    // The FileSystem has to outlive its requests.
+    //
+    // When the isolate has an io_uring engine, reads and writes are
+    // submitted to it and skip the threadpool
+    //
     class FileSystem{
+        class Request;
+        static void on_result(uv_fs_t* req);
+        static void on_stat(uv_fs_t* req);
+        static void on_ring(uring::request* req, ssize_t result);
+        static void complete(Request* req, ssize_t result);
     public:
         enum Encoding{
             Buffer,
@@ -22,13 +46,92 @@ namespace ngn{
             Hex
         };
         typedef int FileHandle;
-        typedef std::function<void (std::exception, string)> readStringCallback;
-        typedef std::function<void (std::exception, FileHandle)> openFileCallback;
+        typedef std::function<void (const std::exception&, string)> readStringCallback;
+        typedef std::function<void (const std::exception&, FileHandle)> openFileCallback;
+        typedef std::function<void (const std::exception&)> writeFileCallback;
+        // result is a descriptor (open), a byte count (read, write) or 0,
+        // and a negative libuv error code on failure
+        typedef inplace_function<void(ssize_t result)> resultCallback;
+        // status is 0 or a libuv error code
+        typedef inplace_function<void(int status, const uv_stat_t& stat)> statCallback;
+        
+        // requests kept for reuse
+        static const size_t max_free_requests = 32;
+        // bounds of readFile's read size, which follows the file's size
+        static const size_t read_chunk_size = 64 * 1024;
+        static const size_t max_read_chunk_size = 1024 * 1024;
+        
+        // madvise() hints for map(), can be combined
+        enum Advice {
+            Normal      = 0,
+            Sequential  = 1 << 0,
+            Random      = 1 << 1,
+            WillNeed    = 1 << 2,
+            HugePage    = 1 << 3
+        };
+        
+        //
+        // Memory Mapping
+        //
+        // Maps the whole file read only. The pages are shared with the page
+        // cache, so nothing is copied until they're touched, and slices of
+        // the buffer can be written to sockets as they are. The mapping is
+        // removed once the last Buffer referencing it goes away.
+        // Throws std::system_error if the file can't be opened or mapped
+        static experimental::Buffer map(const string& path, int advice = Normal);
+        // applies advice to the pages under buffer, which has to come from map()
+        static void advise(const experimental::Buffer& buffer, int advice);
 
+        explicit FileSystem(isolate& isolate = isolate::instance());
+        ~FileSystem();
+        FileSystem(const FileSystem&) = delete;
+        FileSystem& operator=(const FileSystem&) = delete;
+        
+        //
+        // Descriptors
+        //
+        void open(const string& path, int flags, int mode, resultCallback callback);
+        void close(FileHandle fd, resultCallback callback);
+        void fstat(FileHandle fd, statCallback callback);
+        
+        //
+        // Positional I/O
+        //
+        // offset -1 uses (and moves) the descriptor's own position. Reads
+        // fill buffer from its start and report how many bytes arrived, 0
+        // meaning end of file; the bytes past that are left as they were
+        void read(FileHandle fd, experimental::Buffer& buffer, int64_t offset, resultCallback callback);
+        void write(FileHandle fd, const experimental::Buffer& buffer, int64_t offset, resultCallback callback);
+        // scatter/gather over the queue's chunks in a single call
+        void readv(FileHandle fd, experimental::BufferQueue& buffers, int64_t offset, resultCallback callback);
+        void writev(FileHandle fd, const experimental::BufferQueue& buffers, int64_t offset, resultCallback callback);
+        
+        //
+        // Whole Files
+        //
         void openFile(string fileName, openFileCallback callback);
         void readFile(string fileName, Encoding encoding, readStringCallback callback);
-        void writeFile(string fileName, Encoding encoding, const char* buffer, size_t length);
-        void writeFile(string fileName, Encoding encoding, const char* buffer, size_t offset,  size_t length);
+        // Buffer and UTF8 write the bytes as they are, Hex decodes them first
+        void writeFile(string fileName, Encoding encoding, const char* buffer, size_t length,
+                       writeFileCallback callback = nullptr);
+        // offset is where the data starts in buffer
+        void writeFile(string fileName, Encoding encoding, const char* buffer, size_t offset,  size_t length,
+                       writeFileCallback callback = nullptr);
+        
+    private:
+        Request* acquire();
+        void recycle(Request* req);
+        // reports a request that libuv refused on the next tick
+        void reject(Request* req, int status);
+        // hands req->bufs to the io_uring engine, false if there's none
+        // or it can't take them
+        bool submit(Request* req, FileHandle fd, int64_t offset, bool write);
+        // reads or writes req->bufs, through the ring if possible
+        void transfer(Request* req, FileHandle fd, int64_t offset, bool write);
+        uv_loop_t* loop();
+        
+        isolate& m_isolate;
+        std::vector<Request*> m_free_requests;
     };
 }
 
@@ -17,10 +17,20 @@
 #include <chrono>
 #include <stdio.h>
 #include <cxxabi.h>
+#include <atomic>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <vector>
 #include "utils.h"
 #include "eventloop.h"
 #include "io_buffer.h"
+#include "buffer_queue.h"
 #include "isolate.h"
+#include "mpsc_queue.h"
+#include "timer_wheel.h"
+#include "inplace_function.h"
+#include "small_task.h"
 
 
 
@@ -93,6 +103,9 @@ namespace ngn {
         inline EventLoop& event_loop() {
             return m_isolate.event_loop();
         };
+        inline isolate& current_isolate() {
+            return m_isolate;
+        };
 
         operator const uv_handle_t&() const {
             return *reinterpret_cast<const uv_handle_t*>(static_cast<const T*>(const_cast<const HandleWrap*>(this)));
@@ -129,107 +142,250 @@ namespace ngn {
     template <class T, class Alloc = std::allocator<char>>
     class StreamWrap : public HandleWrap<T> {
         typedef Alloc allocator_type;
-        typedef std::function<void(const experimental::Buffer&, size_t)> read_callback;
-        typedef std::function<void(int status)> write_callback;
+        // nread is negative on error or UV_EOF
+        typedef inplace_function<void(const experimental::Buffer&, ssize_t nread)> read_callback;
+        // status is 0 or a libuv error code
+        typedef inplace_function<void(int status)> write_callback;
+        typedef std::vector<write_callback> write_callbacks;
 
+        static inline StreamWrap* from_handle(void* handle) {
+            return static_cast<StreamWrap*>(reinterpret_cast<T*>(handle));
+        }
         static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
-            auto stream = static_cast<StreamWrap*>(handle);
-            stream->m_read_buffer = experimental::Buffer(suggested_size);
-            buf->base = stream->m_read_buffer.data();
-            buf->len = suggested_size;
-            
+            auto stream = from_handle(handle);
+            // read into the isolate's shared slab, nothing is allocated per read
+            *buf = stream->current_isolate().buffer_pool().reserve(suggested_size);
         }
-        static void on_read(uv_stream_t* handle, size_t nread, const uv_buf_t* buf) {
-            auto stream = static_cast<StreamWrap*>(reinterpret_cast<uv_handle_t*>(handle));
-            stream->readfn_(stream->m_read_buffer);
+        static void on_read(uv_stream_t* handle, ssize_t nread, const uv_buf_t* buf) {
+            auto stream = from_handle(handle);
+            // keep the bytes that were read, the rest goes back to the pool
+            auto chunk = stream->current_isolate().buffer_pool().commit(nread > 0 ? nread : 0);
+            if (nread != 0 && stream->readfn_) stream->readfn_(chunk, nread);
         }
         static void on_write(uv_write_t* handle, int status) {
             auto req = static_cast<WriteRequest*>(handle);
-            NGN_UV_CHECK(status);
-            req->fn(status);
-            delete req;
+            // errors are the callbacks' business, throwing through libuv
+            // would leave the loop in a bad state
+            for (auto& fn : req->callbacks)
+                if (fn) fn(status);
+            req->stream->recycle(req);
         }
     public:
-        StreamWrap(EventLoop& loop = EventLoop::default_loop())
-        : HandleWrap<T>(loop) {
+        // a batch this big is queued right away instead of waiting for
+        // the end of the tick
+        static const size_t max_batch_size = 64 * 1024;
+        // write requests kept for reuse
+        static const size_t max_free_requests = 16;
+        
+        StreamWrap(isolate& isolate = isolate::instance())
+        : HandleWrap<T>(isolate), m_flush_scheduled(false) {
             
+        }
+        ~StreamWrap() {
+            for (auto req : m_free_requests)
+                delete req;
         }
         void read_start(read_callback fn) {
-            NGN_UV_CHECK(uv_read_start(this, on_alloc, on_read));
+            readfn_ = std::move(fn);
+            NGN_UV_CHECK(uv_read_start(stream_handle(), on_alloc, on_read));
         }
         void read_stop() {
-            NGN_UV_CHECK(uv_read_stop(this));
+            NGN_UV_CHECK(uv_read_stop(stream_handle()));
         }
         
+        //
+        // Writes
+        //
+        // Writes made during the same tick are gathered and go out together
+        // at the end of it: uv_try_write first, and only what the socket
+        // didn't take right away needs a (pooled) uv_write request. The
+        // callback always runs after write() has returned
+        //
         void write(const experimental::Buffer& buffer, write_callback callback) {
-            std::allocator<char> p;
-            auto req = new WriteRequest(buffer, callback);
-            uv_write(req, this, &req->buffer, 1, on_write);
+            m_batch.append(buffer);
+            enqueue(std::move(callback));
+        }
+        void write(experimental::BufferQueue buffers, write_callback callback) {
+            m_batch.append(std::move(buffers));
+            enqueue(std::move(callback));
         }
     protected:
         operator uv_stream_t&() const {
             return *reinterpret_cast<uv_stream_t*>(static_cast<T*>(const_cast<StreamWrap*>(this)));
         }
+        inline uv_stream_t* stream_handle() {
+            return reinterpret_cast<uv_stream_t*>(this->handle());
+        }
     private:
         class WriteRequest : public uv_write_t {
         public:
-            WriteRequest(const experimental::Buffer& buf, write_callback cb) : buffer(buf), fn(cb) {}
-            const experimental::Buffer buffer;
-            const write_callback fn;
+            explicit WriteRequest(StreamWrap* stream) : stream(stream) {}
+            StreamWrap* stream;
+            // keeps the data alive until the write completes
+            experimental::BufferQueue buffers;
+            std::vector<uv_buf_t> bufs;
+            write_callbacks callbacks;
         };
+        
+        void enqueue(write_callback callback) {
+            m_batch_callbacks.push_back(std::move(callback));
+            if (m_batch.size() >= max_batch_size) {
+                flush(false);
+            } else if (!m_flush_scheduled) {
+                m_flush_scheduled = true;
+                this->event_loop().nextTick([this] {
+                    m_flush_scheduled = false;
+                    flush(true);
+                });
+            }
+        }
+        
+        // try_write would complete callbacks inside write(), so it's only
+        // used from the tick
+        void flush(bool try_write) {
+            if (m_batch_callbacks.empty())
+                return;
+            if (try_write) {
+                int written = 0;
+                if (!m_batch.empty()) {
+                    m_iov.resize(m_batch.chunk_count());
+                    m_batch.iovec(m_iov.data(), m_iov.size());
+                    written = uv_try_write(stream_handle(), m_iov.data(),
+                                           static_cast<unsigned int>(m_iov.size()));
+                }
+                if (written >= 0 && static_cast<size_t>(written) == m_batch.size()) {
+                    complete_batch(0);
+                    return;
+                }
+                if (written < 0 && written != UV_EAGAIN && written != UV_ENOSYS) {
+                    complete_batch(written);
+                    return;
+                }
+                if (written > 0)
+                    m_batch.trim_start(written);
+            }
+            
+            WriteRequest* req = acquire();
+            // the request's emptied queue and vector become the next batch
+            req->buffers.swap(m_batch);
+            req->callbacks.swap(m_batch_callbacks);
+            req->bufs.resize(req->buffers.chunk_count());
+            req->buffers.iovec(req->bufs.data(), req->bufs.size());
+            int result = uv_write(req, stream_handle(), req->bufs.data(),
+                                  static_cast<unsigned int>(req->bufs.size()), on_write);
+            if (result < 0) {
+                this->event_loop().nextTick([req, result] {
+                    on_write(req, result);
+                });
+            }
+        }
+        
+        void complete_batch(int status) {
+            m_batch.clear();
+            // callbacks may write again, which starts a new batch
+            write_callbacks callbacks;
+            callbacks.swap(m_batch_callbacks);
+            for (auto& fn : callbacks)
+                if (fn) fn(status);
+            callbacks.clear();
+            if (m_batch_callbacks.empty())
+                m_batch_callbacks.swap(callbacks);
+        }
+        
+        WriteRequest* acquire() {
+            if (m_free_requests.empty())
+                return new WriteRequest(this);
+            WriteRequest* req = m_free_requests.back();
+            m_free_requests.pop_back();
+            return req;
+        }
+        void recycle(WriteRequest* req) {
+            req->buffers.clear();
+            req->callbacks.clear();
+            if (m_free_requests.size() < max_free_requests)
+                m_free_requests.push_back(req);
+            else
+                delete req;
+        }
+        
         allocator_type allocator;
 
-        experimental::Buffer m_read_buffer;
         read_callback readfn_;
+        
+        experimental::BufferQueue m_batch;
+        write_callbacks m_batch_callbacks;
+        std::vector<uv_buf_t> m_iov;
+        std::vector<WriteRequest*> m_free_requests;
+        bool m_flush_scheduled;
     };
     
 #undef NGN_GET_HANDLE
    
+    //
+    // Timers live on the isolate's timer_wheel rather than each owning a
+    // uv_timer_t, a Timer is just a node in it so (re)arming is O(1) and
+    // never allocates
+    //
     class Timer :
-    public HandleWrap<uv_timer_t> ,
+    public timer_wheel::hook,
     public std::enable_shared_from_this<Timer> {
-        static void timer_callback(uv_timer_t* handle, int status) {
-            static_cast<Timer*>(handle)->fn_();
-        };
+        void on_expire() {
+            fn_();
+        }
     public:
         typedef std::chrono::milliseconds milliseconds;
-        typedef std::function<void()> callback;
+        typedef inplace_function<void()> callback;
         
+        // the returned timer belongs to the wheel: it's freed after it has
+        // fired or once it's stopped, don't touch it after either
         static Timer& setTimeout(callback fn, milliseconds timeout, isolate& isolate = isolate::instance()) {
             Timer* timer = new Timer(isolate);
-            timer->start(fn, timeout);
+            timer->wheel_owned(true);
+            timer->start(std::move(fn), timeout);
             return *timer;
         }
+        // freed once it's stopped
         static Timer& setInterval(callback fn, milliseconds interval, isolate& loop = isolate::instance()) {
             Timer* timer = new Timer(loop);
-            timer->start(fn, interval, interval);
+            timer->wheel_owned(true);
+            timer->start(std::move(fn), interval, interval);
             return *timer;
         }
         void start(callback fn, milliseconds timeout = milliseconds(0),
                    milliseconds repeat = milliseconds(0)) {
-            fn_ = fn;
-            handle()->data = &fn_;
-            NGN_UV_CHECK(uv_timer_start(this,
-                                        Timer::timer_callback, timeout.count(),
-                                        repeat.count()));
+            fn_ = std::move(fn);
+            start(timeout, repeat);
+        }
+        // re-arms with the current callback, an idle timeout that gets
+        // pushed back on every read costs an unlink and a relink
+        void start(milliseconds timeout, milliseconds repeat = milliseconds(0)) {
+            wheel().schedule(*this, timeout.count(), repeat.count());
         }
         void stop() {
-            NGN_UV_CHECK(uv_timer_stop(this));
+            wheel().cancel(*this);
         }
         void again() {
-            int result = uv_timer_again(this);
+            if (interval())
+                start(repeat(), repeat());
         }
         milliseconds repeat() {
-            return milliseconds(uv_timer_get_repeat(this));
+            return milliseconds(interval());
         }
         void repeat(milliseconds repeat) {
-            return uv_timer_set_repeat(this, repeat.count());
+            interval(repeat.count());
+        }
+        bool is_active() const {
+            return is_linked();
+        }
+        void ref() {
+            wheel().ref(*this);
+        }
+        void unref() {
+            wheel().unref(*this);
+        }
+        
+        Timer(isolate& isolate = isolate::instance()) : hook(isolate.timers()) {
         }
-    //private:
-       NGN_HANDLE_CONSTRUCTOR(Timer, uv_timer_t) {
-            uv_timer_init(event_loop(), this);
-            this->data = this;
-       };
         callback fn_;
     };
     
@@ -241,9 +397,9 @@ namespace ngn {
             static_cast<Idler*>(handle)->fn_();
         }
     public:
-        typedef std::function<void()> callback;
+        typedef inplace_function<void()> callback;
         void start(callback fn = nullptr) {
-            fn_ = fn;
+            fn_ = std::move(fn);
             NGN_UV_CHECK(uv_idle_start(this, idle_callback));
         }
         void stop() {
@@ -265,13 +421,13 @@ namespace ngn {
             static_cast<Signal*>(handle)->fn_(status);
         }
     public:
-        typedef std::function<void(int)> callback;
+        typedef inplace_function<void(int)> callback;
         NGN_HANDLE_CONSTRUCTOR(Signal, uv_signal_t) {
             NGN_UV_CHECK(uv_signal_init(event_loop(), this));
         }
         
         void start(callback fn, int signal) {
-            fn_ = fn;
+            fn_ = std::move(fn);
             NGN_UV_CHECK(uv_signal_start(this, on_signal, signal));
         }
         
@@ -291,9 +447,9 @@ namespace ngn {
         }
     public:
         using Wrapper = HandleWrap<uv_async_t>;
-        using callback = std::function<void()>;
+        using callback = inplace_function<void()>;
         
-        Async(callback fn, isolate& isolate = isolate::instance()) :  Wrapper(isolate), m_fn(fn) {
+        Async(callback fn, isolate& isolate = isolate::instance()) :  Wrapper(isolate), m_fn(std::move(fn)) {
             uv_async_init(isolate.event_loop().handle(), this, on_async);
         }
         void send() {
@@ -303,79 +459,129 @@ namespace ngn {
         callback m_fn;
     };
     class message_source;
+    //
+    // Runs callbacks posted from any thread on the loop that owns the sink
+    // Producers push into a pre-allocated lock-free ring and only the one
+    // that finds the sink idle pays for the uv_async_send, the loop then
+    // drains at most batch_limit callbacks per wakeup so a busy producer
+    // can't starve everything else. A full ring spills into a locked list
+    // so post() never fails. Callbacks are small_tasks, so posting a lambda
+    // with a few captures doesn't allocate either
+    //
     class message_sink : private HandleWrap<uv_async_t> , public std::enable_shared_from_this<message_sink> {
         static void on_sink(uv_async_t* handle, int status) {
             auto sink = static_cast<message_sink*>(handle);
-            if (!sink->is_empty) {
-                assert(!sink->is_flushed);
-                sink->is_flushed = false;
-                for (auto fn : sink->m_pending)
-                    fn();
-                sink->m_pending.clear();
-                sink->is_empty = true;
-                sink->is_flushed = true;
-            }
+            // cleared before draining: anything pushed from here on either
+            // gets picked up below or sends a fresh wakeup
+            sink->m_signalled.store(false);
+            if (sink->drain(sink->m_batch_limit))
+                sink->signal();
         }
     public:
-        using callback = std::function<void()>;
-        using queue = std::vector<callback>;
-        message_sink(isolate& isolate = isolate::instance()) : HandleWrap<uv_async_t>(isolate), is_empty(true), is_flushed(true) {
+        using callback = small_task;
+        using Wrapper = HandleWrap<uv_async_t>;
+        static const size_t default_capacity = 1024;
+        static const size_t default_batch_limit = 256;
+        
+        message_sink(isolate& isolate = isolate::instance(),
+                     size_t capacity = default_capacity,
+                     size_t batch_limit = default_batch_limit) :
+            Wrapper(isolate),
+            m_queue(capacity),
+            m_batch_limit(batch_limit ? batch_limit : 1),
+            m_signalled(false),
+            m_spilled(false) {
             uv_async_init(isolate.event_loop().handle(), this, on_sink);
             unref();
         }
         friend class message_source;
         ~message_sink() {
-            on_sink(this, 0);
+            // the handle may be closed already, run what's left inline
+            while (drain(std::numeric_limits<size_t>::max()));
+        }
+        
+        using Wrapper::ref;
+        using Wrapper::unref;
+        using Wrapper::close;
+        using Wrapper::is_closing;
+        using Wrapper::current_isolate;
+        
+        // any thread; false when the ring is full
+        bool try_post(callback fn) {
+            if (m_spilled.load(std::memory_order_acquire) || !m_queue.try_push(std::move(fn)))
+                return false;
+            signal();
+            return true;
+        }
+        
+        // any thread; never blocks on the loop
+        void post(callback fn) {
+            // once something spilled keep spilling until the loop caught up,
+            // otherwise later posts could overtake it through the ring
+            if (m_spilled.load(std::memory_order_acquire) || !m_queue.try_push(std::move(fn))) {
+                std::lock_guard<std::mutex> lock(m_spill_mutex);
+                m_spill.push_back(std::move(fn));
+                m_spilled.store(true, std::memory_order_release);
+            }
+            signal();
+        }
+        
+        size_t batch_limit() const {
+            return m_batch_limit;
+        }
+        void batch_limit(size_t limit) {
+            m_batch_limit = limit ? limit : 1;
         }
     private:
-        void notify() {
-            uv_async_send(this);
+        void signal() {
+            if (!m_signalled.exchange(true))
+                uv_async_send(this);
+        }
+        // runs up to limit callbacks, true if there's more waiting
+        bool drain(size_t limit) {
+            callback fn;
+            size_t count = 0;
+            while (count < limit && m_queue.try_pop(fn)) {
+                ++count;
+                fn();
+            }
+            if (count == limit)
+                return true;
+            if (m_spilled.load(std::memory_order_acquire)) {
+                std::deque<callback> spill;
+                {
+                    std::lock_guard<std::mutex> lock(m_spill_mutex);
+                    spill.swap(m_spill);
+                    m_spilled.store(false, std::memory_order_release);
+                }
+                for (auto& spilled : spill)
+                    spilled();
+            }
+            return !m_queue.empty();
         }
-        std::atomic_bool is_empty;
-        std::atomic_bool is_flushed;
-        queue m_pending;
         
+        mpsc_queue<callback> m_queue;
+        size_t m_batch_limit;
+        std::atomic<bool> m_signalled;
+        std::atomic<bool> m_spilled;
+        std::mutex m_spill_mutex;
+        std::deque<callback> m_spill;
     };
     
+    // Posting end of a message_sink, callable from any thread
     class message_source : public std::enable_shared_from_this<message_source> {
-        
     public:
         using callback = message_sink::callback;
-        using queue = message_sink::queue;
-        message_source(message_sink& sink, isolate& isolate = isolate::instance()) : m_sink(sink), m_send_idle(isolate){
-            m_send_idle.start([=] { flush(); });
-            m_send_idle.unref();
-        }
-        bool flush () {
-            if (m_pending.size() > 0) {
-                if (m_sink.is_flushed) {
-                    assert(m_sink.m_pending.size() == 0);
-                    m_sink.m_pending.swap(m_pending);
-                    m_sink.is_flushed = false;
-                    m_sink.notify();
-                    return true;
-                } else {
-                    m_sink.notify();
-                    return false;
-                }
-            } else {
-                return true;
-            }
+        message_source(message_sink& sink) : m_sink(sink) {
         }
-        void operator() (callback fn) {
-            m_pending.push_back(fn);
-            m_sink.is_empty = false;
-            
+        bool try_post(callback fn) {
+            return m_sink.try_post(std::move(fn));
         }
-        ~message_source() {
-            // drain messages
-            while(!flush());
+        void operator() (callback fn) {
+            m_sink.post(std::move(fn));
         }
     private:
         message_sink& m_sink;
-        Idler m_send_idle;
-        queue m_pending;
-        
     };
 }
 
@@ -0,0 +1,247 @@
+//
+//  hex.cpp
+//  ngn
+//
+//
+//
+
+#include "hex.h"
+#include "cpu_features.h"
+
+#include <assert.h>
+#include <stdint.h>
+
+#if defined(NGN_HAVE_X86_DISPATCH)
+#include <immintrin.h>
+#endif
+
+namespace ngn {
+    namespace {
+        const char hex_table[] = "0123456789abcdef";
+        
+        // Same contract as the base64 kernels: convert whole blocks, advance
+        // the pointers, and leave the tail (or the block holding an invalid
+        // digit) to the scalar loop.
+        struct hex_kernel {
+            void (*encode)(const uint8_t*& src, const uint8_t* src_end, char*& dst);
+            void (*decode)(const char*& src, const char* src_end, uint8_t*& dst, uint8_t* dst_end);
+        };
+        
+        //
+        // Scalar
+        //
+        
+        void encode_scalar(const uint8_t*&, const uint8_t*, char*&) {}
+        void decode_scalar(const char*&, const char*, uint8_t*&, uint8_t*) {}
+        
+#if defined(NGN_HAVE_X86_DISPATCH)
+        //
+        // SSE4.1
+        //
+        // Both directions are nibble lookups with pshufb. A digit is valid
+        // when the class of its high nibble and the class of its low nibble
+        // share a bit: 0x3_ takes low nibbles 0-9, 0x4_ and 0x6_ take 1-6.
+        //
+        
+        NGN_TARGET("sse4.1")
+        inline __m128i digits_lut() {
+            return _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                 '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+        }
+        
+        NGN_TARGET("sse4.1")
+        inline __m128i high_class_lut() {
+            return _mm_setr_epi8(0, 0, 0, 1, 2, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        }
+        
+        NGN_TARGET("sse4.1")
+        inline __m128i low_class_lut() {
+            return _mm_setr_epi8(1, 3, 3, 3, 3, 3, 3, 1, 1, 1, 0, 0, 0, 0, 0, 0);
+        }
+        
+        NGN_TARGET("sse4.1")
+        inline __m128i high_offset_lut() {
+            return _mm_setr_epi8(0, 0, 0, 0, 9, 0, 9, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        }
+        
+        // 16 digits -> 16 nibble values, false if any digit is invalid.
+        // bytes >= 0x80 make pshufb return 0, so they fail the class test
+        NGN_TARGET("sse4.1")
+        inline bool decode_nibbles(__m128i in, __m128i& out) {
+            const __m128i mask = _mm_set1_epi8(0x0f);
+            const __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+            const __m128i lo = _mm_and_si128(in, mask);
+            const __m128i cls = _mm_and_si128(_mm_shuffle_epi8(high_class_lut(), hi),
+                                              _mm_shuffle_epi8(low_class_lut(), lo));
+            const __m128i invalid = _mm_cmpeq_epi8(cls, _mm_setzero_si128());
+            if (_mm_movemask_epi8(invalid) != 0)
+                return false;
+            out = _mm_add_epi8(lo, _mm_shuffle_epi8(high_offset_lut(), hi));
+            return true;
+        }
+        
+        NGN_TARGET("sse4.1")
+        void encode_sse41(const uint8_t*& src, const uint8_t* src_end, char*& dst) {
+            const __m128i mask = _mm_set1_epi8(0x0f);
+            const __m128i lut = digits_lut();
+            
+            while (src_end - src >= 16) {
+                const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+                const __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+                const __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(in, mask));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi8(hi, lo));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi8(hi, lo));
+                src += 16;
+                dst += 32;
+            }
+        }
+        
+        NGN_TARGET("sse4.1")
+        void decode_sse41(const char*& src, const char* src_end, uint8_t*& dst, uint8_t* dst_end) {
+            // high nibble * 16 + low nibble for every pair
+            const __m128i weights = _mm_set1_epi16(0x0110);
+            
+            while (src_end - src >= 32 && dst_end - dst >= 16) {
+                __m128i a, b;
+                if (!decode_nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), a) ||
+                    !decode_nibbles(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16)), b))
+                    return;
+                const __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(a, weights),
+                                                       _mm_maddubs_epi16(b, weights));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), bytes);
+                src += 32;
+                dst += 16;
+            }
+        }
+        
+        //
+        // AVX2
+        //
+        
+        NGN_TARGET("avx2")
+        inline __m256i broadcast(__m128i lut) {
+            return _mm256_inserti128_si256(_mm256_castsi128_si256(lut), lut, 1);
+        }
+        
+        NGN_TARGET("avx2")
+        inline bool decode_nibbles(__m256i in, __m256i& out) {
+            const __m256i mask = _mm256_set1_epi8(0x0f);
+            const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(in, 4), mask);
+            const __m256i lo = _mm256_and_si256(in, mask);
+            const __m256i cls = _mm256_and_si256(_mm256_shuffle_epi8(broadcast(high_class_lut()), hi),
+                                                 _mm256_shuffle_epi8(broadcast(low_class_lut()), lo));
+            const __m256i invalid = _mm256_cmpeq_epi8(cls, _mm256_setzero_si256());
+            if (_mm256_movemask_epi8(invalid) != 0)
+                return false;
+            out = _mm256_add_epi8(lo, _mm256_shuffle_epi8(broadcast(high_offset_lut()), hi));
+            return true;
+        }
+        
+        NGN_TARGET("avx2")
+        void encode_avx2(const uint8_t*& src, const uint8_t* src_end, char*& dst) {
+            const __m256i mask = _mm256_set1_epi8(0x0f);
+            const __m256i lut = broadcast(digits_lut());
+            
+            while (src_end - src >= 32) {
+                const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+                const __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+                const __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(in, mask));
+                // unpack works per 128 bit lane, put the halves back in order
+                const __m256i first = _mm256_unpacklo_epi8(hi, lo);
+                const __m256i second = _mm256_unpackhi_epi8(hi, lo);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(first, second, 0x20));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(first, second, 0x31));
+                src += 32;
+                dst += 64;
+            }
+            encode_sse41(src, src_end, dst);
+        }
+        
+        NGN_TARGET("avx2")
+        void decode_avx2(const char*& src, const char* src_end, uint8_t*& dst, uint8_t* dst_end) {
+            const __m256i weights = _mm256_set1_epi16(0x0110);
+            
+            while (src_end - src >= 64 && dst_end - dst >= 32) {
+                __m256i a, b;
+                if (!decode_nibbles(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)), a) ||
+                    !decode_nibbles(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32)), b))
+                    break;
+                // packus interleaves the lanes of a and b, undo that
+                const __m256i bytes = _mm256_packus_epi16(_mm256_maddubs_epi16(a, weights),
+                                                          _mm256_maddubs_epi16(b, weights));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute4x64_epi64(bytes, 0xD8));
+                src += 64;
+                dst += 32;
+            }
+            decode_sse41(src, src_end, dst, dst_end);
+        }
+#endif
+        
+        hex_kernel select_kernel() noexcept {
+#if defined(NGN_HAVE_X86_DISPATCH)
+            const cpu::features& cpu = cpu::detect();
+            if (cpu.avx2)
+                return {encode_avx2, decode_avx2};
+            if (cpu.sse41)
+                return {encode_sse41, decode_sse41};
+#endif
+            return {encode_scalar, decode_scalar};
+        }
+        
+        const hex_kernel& kernel() noexcept {
+            static const hex_kernel selected = select_kernel();
+            return selected;
+        }
+    }
+    
+    
+    size_t hex_encode(const char* src, size_t slen, char* dst, size_t dlen) {
+        // We know how much we'll write, just make sure that there's space.
+        assert(dlen >= slen * 2 &&
+               "not enough space provided for hex encode");
+        
+        dlen = slen * 2;
+        
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* in_end = in + slen;
+        
+        kernel().encode(in, in_end, dst);
+        
+        for (; in != in_end; ++in, dst += 2) {
+            dst[0] = hex_table[*in >> 4];
+            dst[1] = hex_table[*in & 15];
+        }
+        
+        return dlen;
+    };
+    
+    
+    size_t hex_decode(char* buf,
+                      size_t len,
+                      const char* src,
+                      size_t srcLen,
+                      size_t* error_offset) {
+        uint8_t* dst = reinterpret_cast<uint8_t*>(buf);
+        uint8_t* dst_end = dst + len;
+        const char* begin = src;
+        const char* src_end = src + (srcLen & ~size_t(1));
+        
+        kernel().decode(src, src_end, dst, dst_end);
+        
+        size_t invalid = srcLen;
+        for (; src != src_end && dst != dst_end; src += 2) {
+            unsigned a = hex2bin(src[0]);
+            unsigned b = hex2bin(src[1]);
+            if (!~a || !~b) {
+                invalid = (src - begin) + !!~a;
+                break;
+            }
+            *dst++ = a * 16 + b;
+        }
+        
+        if (error_offset != nullptr)
+            *error_offset = invalid;
+        
+        return dst - reinterpret_cast<uint8_t*>(buf);
+    };
+}
@@ -0,0 +1,42 @@
+//
+//  hex.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__hex__
+#define __ngn__hex__
+
+#include <cstddef>
+
+namespace ngn {
+    //// HEX ////
+    
+    template <typename TypeName>
+    unsigned hex2bin(TypeName c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'A' && c <= 'F')
+            return 10 + (c - 'A');
+        if (c >= 'a' && c <= 'f')
+            return 10 + (c - 'a');
+        return static_cast<unsigned>(-1);
+    };
+    
+    // writes slen * 2 lowercase hex digits to dst, returns the number written
+    size_t hex_encode(const char* src, size_t slen, char* dst, size_t dlen);
+    
+    // decodes digit pairs (either case) until len bytes are written or src
+    // runs out, a trailing odd digit is ignored. stops at the first invalid
+    // pair and, when error_offset is given, stores the offset of the first
+    // invalid character there (or srcLen if there wasn't one).
+    // returns the number of bytes written
+    size_t hex_decode(char* buf,
+                      size_t len,
+                      const char* src,
+                      size_t srcLen,
+                      size_t* error_offset = nullptr);
+}
+
+#endif /* defined(__ngn__hex__) */
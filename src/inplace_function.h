@@ -0,0 +1,233 @@
+//
+//  inplace_function.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__inplace_function__
+#define __ngn__inplace_function__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ngn {
+    // enough for a this pointer plus a few captures, or a std::function
+    static const size_t inplace_function_default_capacity = 6 * sizeof(void*);
+
+    template <typename Signature,
+              size_t Capacity = inplace_function_default_capacity,
+              bool HeapFallback = false>
+    class inplace_function;
+
+    namespace detail {
+        template <typename F, typename R, typename... Args>
+        struct is_callable_as {
+            template <typename U,
+                      typename Result = decltype(std::declval<U&>()(std::declval<Args>()...))>
+            static std::integral_constant<bool,
+                std::is_void<R>::value || std::is_convertible<Result, R>::value> test(int);
+            template <typename U>
+            static std::false_type test(...);
+
+            static const bool value = decltype(test<F>(0))::value;
+        };
+
+        template <typename F>
+        inline bool is_null_callable(const F&) noexcept {
+            return false;
+        }
+        template <typename R, typename... Args>
+        inline bool is_null_callable(R (*fn)(Args...)) noexcept {
+            return fn == nullptr;
+        }
+        template <typename R, typename... Args, size_t Capacity, bool HeapFallback>
+        inline bool is_null_callable(const inplace_function<R(Args...), Capacity, HeapFallback>& fn) noexcept {
+            return !fn;
+        }
+        template <typename Signature>
+        inline bool is_null_callable(const std::function<Signature>& fn) noexcept {
+            return !fn;
+        }
+    }
+
+    //
+    // Move-only std::function replacement that stores the callable inline
+    //
+    // Anything up to Capacity bytes (and no more aligned than max_align_t)
+    // lives inside the object, so binding a callback never allocates.
+    // Bigger callables are a compile error unless HeapFallback is set, in
+    // which case they're boxed on the heap. Callables that may throw when
+    // moved are boxed too, so moving an inplace_function never throws
+    //
+    template <typename R, typename... Args, size_t Capacity, bool HeapFallback>
+    class inplace_function<R(Args...), Capacity, HeapFallback> {
+        struct vtable {
+            R (*invoke)(void*, Args&&...);
+            void (*move)(void* dst, void* src);
+            void (*destroy)(void*);
+        };
+
+        template <typename F>
+        struct local {
+            static R invoke(void* storage, Args&&... args) {
+                return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+            };
+            static void move(void* dst, void* src) {
+                new (dst) F(std::move(*static_cast<F*>(src)));
+                static_cast<F*>(src)->~F();
+            };
+            static void destroy(void* storage) {
+                static_cast<F*>(storage)->~F();
+            };
+            static const vtable table;
+        };
+
+        template <typename F>
+        struct boxed {
+            static F*& get(void* storage) {
+                return *static_cast<F**>(storage);
+            };
+            static R invoke(void* storage, Args&&... args) {
+                return (*get(storage))(std::forward<Args>(args)...);
+            };
+            static void move(void* dst, void* src) {
+                new (dst) F*(get(src));
+            };
+            static void destroy(void* storage) {
+                delete get(storage);
+            };
+            static const vtable table;
+        };
+    public:
+        typedef R result_type;
+        static const size_t capacity = Capacity;
+
+        template <typename F>
+        struct fits : std::integral_constant<bool,
+            sizeof(F) <= Capacity &&
+            alignof(F) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<F>::value> {};
+
+        inplace_function() noexcept : m_vtable(nullptr) {};
+        inplace_function(std::nullptr_t) noexcept : m_vtable(nullptr) {};
+
+        template <typename F,
+                  typename Fn = typename std::decay<F>::type,
+                  typename = typename std::enable_if<
+                      !std::is_same<Fn, inplace_function>::value &&
+                      detail::is_callable_as<Fn, R, Args...>::value>::type>
+        inplace_function(F&& fn) : m_vtable(nullptr) {
+            static_assert(HeapFallback || fits<Fn>::value,
+                          "callable doesn't fit in this inplace_function, "
+                          "raise its Capacity or enable HeapFallback");
+            if (!detail::is_null_callable(fn))
+                construct<Fn>(std::forward<F>(fn), fits<Fn>());
+        };
+
+        inplace_function(inplace_function&& other) noexcept : m_vtable(other.m_vtable) {
+            if (m_vtable) {
+                m_vtable->move(&m_storage, &other.m_storage);
+                other.m_vtable = nullptr;
+            }
+        };
+        inplace_function(const inplace_function&) = delete;
+
+        inplace_function& operator=(inplace_function&& other) noexcept {
+            if (this != &other) {
+                reset();
+                if (other.m_vtable) {
+                    other.m_vtable->move(&m_storage, &other.m_storage);
+                    m_vtable = other.m_vtable;
+                    other.m_vtable = nullptr;
+                }
+            }
+            return *this;
+        };
+        inplace_function& operator=(std::nullptr_t) noexcept {
+            reset();
+            return *this;
+        };
+        inplace_function& operator=(const inplace_function&) = delete;
+
+        ~inplace_function() {
+            reset();
+        };
+
+        explicit operator bool() const noexcept {
+            return m_vtable != nullptr;
+        };
+
+        R operator()(Args... args) const {
+            if (m_vtable == nullptr)
+                throw std::bad_function_call();
+            return m_vtable->invoke(const_cast<void*>(static_cast<const void*>(&m_storage)), std::forward<Args>(args)...);
+        };
+
+        void swap(inplace_function& other) noexcept {
+            inplace_function tmp(std::move(other));
+            other = std::move(*this);
+            *this = std::move(tmp);
+        };
+
+    private:
+        template <typename Fn, typename F>
+        void construct(F&& fn, std::true_type) {
+            new (&m_storage) Fn(std::forward<F>(fn));
+            m_vtable = &local<Fn>::table;
+        };
+        template <typename Fn, typename F>
+        void construct(F&& fn, std::false_type) {
+            static_assert(sizeof(Fn*) <= Capacity, "inplace_function too small to box a callable");
+            new (&m_storage) Fn*(new Fn(std::forward<F>(fn)));
+            m_vtable = &boxed<Fn>::table;
+        };
+        void reset() noexcept {
+            if (m_vtable) {
+                m_vtable->destroy(&m_storage);
+                m_vtable = nullptr;
+            }
+        };
+
+        const vtable* m_vtable;
+        typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type m_storage;
+    };
+
+    template <typename R, typename... Args, size_t Capacity, bool HeapFallback>
+    template <typename F>
+    const typename inplace_function<R(Args...), Capacity, HeapFallback>::vtable
+    inplace_function<R(Args...), Capacity, HeapFallback>::local<F>::table = {
+        &inplace_function::template local<F>::invoke,
+        &inplace_function::template local<F>::move,
+        &inplace_function::template local<F>::destroy
+    };
+
+    template <typename R, typename... Args, size_t Capacity, bool HeapFallback>
+    template <typename F>
+    const typename inplace_function<R(Args...), Capacity, HeapFallback>::vtable
+    inplace_function<R(Args...), Capacity, HeapFallback>::boxed<F>::table = {
+        &inplace_function::template boxed<F>::invoke,
+        &inplace_function::template boxed<F>::move,
+        &inplace_function::template boxed<F>::destroy
+    };
+
+    template <typename Signature, size_t Capacity, bool HeapFallback>
+    inline void swap(inplace_function<Signature, Capacity, HeapFallback>& lhs,
+                     inplace_function<Signature, Capacity, HeapFallback>& rhs) noexcept {
+        lhs.swap(rhs);
+    }
+
+    template <typename Signature, size_t Capacity, bool HeapFallback>
+    inline bool operator==(const inplace_function<Signature, Capacity, HeapFallback>& fn, std::nullptr_t) noexcept {
+        return !fn;
+    }
+    template <typename Signature, size_t Capacity, bool HeapFallback>
+    inline bool operator!=(const inplace_function<Signature, Capacity, HeapFallback>& fn, std::nullptr_t) noexcept {
+        return bool(fn);
+    }
+}
+
+#endif /* defined(__ngn__inplace_function__) */
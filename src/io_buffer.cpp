@@ -10,9 +10,6 @@
 #include <assert.h>
 
 
-namespace {
-    
-}
 namespace ngn { namespace experimental {
     typedef Buffer::iterator iterator;
     typedef Buffer::const_iterator const_iterator;
@@ -27,83 +24,71 @@ namespace ngn { namespace experimental {
     typedef Buffer::pointer pointer;
     typedef Buffer::const_pointer const_pointer;
     
+    Buffer::take_ownership_tag Buffer::take_ownership;
+    Buffer::non_owning_tag Buffer::non_owning;
+    Buffer::read_only_tag Buffer::read_only;
     
-
-
-    
-
-
-
-    
-    /*
-    Buffer::Buffer(std::unique_ptr<value_type>&& source, size_type offset, size_type size)
-    : Buffer(source.release(), offset, size, take_ownership) {};
-    
-    Buffer::Buffer(pointer buffer, size_type offset,
-                   size_type size, take_ownership_tag)
-    : storage_(new BufferHeader(buffer, true)),
-    data_(buffer+offset),
-    size_(size){};
-    
-    Buffer::Buffer(pointer buffer, size_type offset, size_type size, non_owning_tag)
-    : storage_(new BufferHeader(buffer)),
-      data_(buffer+offset),
-      size_(size) {};*/
-    /*
-     Buffer::Buffer(const Buffer& other, size_type offset, size_type size) : storage_(other.storage_), data_(other.data_ + offset), size_(size) {
-     if (storage_->is_owned) storage_->ref_count.fetch_add(1, std::memory_order_relaxed);
-     }*/
+    //
+    // Constructors
+    //
+    Buffer::Buffer() noexcept : storage_(nullptr), data_(nullptr), size_(0) {};
     
     // optimize for buffers
     Buffer::Buffer(const_iterator begin, const_iterator end)
-    : Buffer(std::distance(begin, end)) {
-        std::memcpy(data_, begin, size_);
+    : Buffer(begin, static_cast<size_type>(std::distance(begin, end))) {};
+    
+    Buffer::Buffer(const_iterator begin, size_type size)
+    : Buffer(size) {
+        if (size) std::memcpy(data_, begin, size);
     }
+    
+    // take ownership
+    Buffer::Buffer(std::unique_ptr<value_type[]>&& source, size_type offset, size_type size)
+    : Buffer(source.get(), offset, size, take_ownership, source.get_deleter()) {
+        source.release();
+    };
+    
+    // wrap
+    Buffer::Buffer(pointer buffer, size_type offset, size_type size, non_owning_tag) noexcept
+    : storage_(nullptr), data_(buffer + offset), size_(size) {};
+    
+    // slice constructor, the caller has already taken a reference
+    Buffer::Buffer(buffer_header_base* storage, pointer data, size_type size) noexcept
+    : storage_(storage), data_(data), size_(size) {};
+    
     // copy constructor
-    Buffer::Buffer(const Buffer& other) noexcept {
-        // should we copy the buffer?
-        // copying the data with  memcpy would be more like string
-        // but it makes it confusing to work with
-        if (*this != other) {
-            storage_ = other.storage_;
-            size_ = other.size_;
-            data_ = other.data_;
-            if (other && storage_->is_owner) {
-                storage_->ref_count.fetch_add(1, std::memory_order_relaxed);
-            }
-        }
+    // copies share storage, copy the bytes explicitly if you need to
+    Buffer::Buffer(const Buffer& other) noexcept
+    : storage_(other.storage_), data_(other.data_), size_(other.size_) {
+        if (storage_) storage_->ref_count.fetch_add(1, std::memory_order_relaxed);
     };
     // move constructor
-    Buffer::Buffer(Buffer&& other) noexcept : data_(other.data_), size_(other.size_) {
-        using std::swap;
-        // other buffer destructor will take care of ref counts
-        swap(storage_, other.storage_);
+    Buffer::Buffer(Buffer&& other) noexcept
+    : storage_(other.storage_), data_(other.data_), size_(other.size_) {
+        // other buffer no longer holds a reference
+        other.storage_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
     }
     
-    // slice constructor
-    /*Buffer::Buffer(buffer_header_base* header, iterator begin, iterator end, slice_buffer_tag)
-    : storage_(header),
-    data_(begin),
-    size_(std::distance(begin, end)){
-        storage_->ref_count.fetch_add(1, std::memory_order_relaxed);
-    }*/
-    
     Buffer::~Buffer() noexcept {
-        // if we are the last owner of a user-defined buffer, free it's memory
-        if (storage_->is_owner &&
+        release();
+    };
+    
+    void Buffer::release() noexcept {
+        // if we are the last owner free the memory
+        if (storage_ &&
             storage_->ref_count.fetch_sub(1, std::memory_order_release) == 1) {
             std::atomic_thread_fence(std::memory_order_acquire);
             storage_->release();
-        } else if (!storage_->is_owner) {
-            storage_->release();
-            //delete[] reinterpret_cast<char*>(storage_->handle);
         }
-    };
+        storage_ = nullptr;
+    }
     
     //
     // Modifiers
     //
-    void Buffer::swap(Buffer& other) {
+    void Buffer::swap(Buffer& other) noexcept {
         using std::swap;
         swap(size_, other.size_);
         swap(data_, other.data_);
@@ -123,18 +108,68 @@ namespace ngn { namespace experimental {
     //
     // Views
     //
-    /*Buffer Buffer::slice(iterator begin, iterator end) {
-        return Buffer(this->storage_, begin, end, slice_buffer);
+    Buffer Buffer::slice(iterator begin, iterator end) const {
+        assert(begin >= data_ && end <= data_ + size_ && begin <= end);
+        if (storage_) storage_->ref_count.fetch_add(1, std::memory_order_relaxed);
+        return Buffer(storage_, begin, static_cast<size_type>(std::distance(begin, end)));
+    };
+    
+    Buffer Buffer::slice(size_type offset, size_type size) const {
+        if (offset + size > size_)
+            throw std::out_of_range("offset + size must not exceed the size of the buffer");
+        return slice(data_ + offset, data_ + offset + size);
     };
     
     //
     // Smart Pointer Methods
     //
-    uint Buffer::use_count() const noexcept {
-        return storage_->ref_count.load();
+    unsigned Buffer::use_count() const noexcept {
+        return storage_ ? storage_->ref_count.load(std::memory_order_relaxed) : 0;
     };
     bool Buffer::is_owned() const noexcept {
-        return storage_->is_owned;
+        return storage_ != nullptr;
+    };
+    bool Buffer::is_unique() const noexcept {
+        // acquire so writes made through other references happen before
+        // we reuse the memory
+        return storage_ && storage_->ref_count.load(std::memory_order_acquire) == 1;
+    };
+    
+    //
+    // Headroom/Tailroom
+    //
+    size_type Buffer::headroom() const noexcept {
+        if (storage_ == nullptr || storage_->read_only) return 0;
+        return static_cast<size_type>(data_ - storage_->base);
+    };
+    size_type Buffer::tailroom() const noexcept {
+        if (storage_ == nullptr || storage_->read_only) return 0;
+        return static_cast<size_type>(storage_->base + storage_->capacity - (data_ + size_));
+    };
+    size_type Buffer::capacity() const noexcept {
+        return storage_ ? storage_->capacity : size_;
+    };
+    void Buffer::prepend(size_type count) {
+        if (count > headroom())
+            throw std::out_of_range("count must not exceed the headroom of the buffer");
+        data_ -= count;
+        size_ += count;
+    };
+    void Buffer::append(size_type count) {
+        if (count > tailroom())
+            throw std::out_of_range("count must not exceed the tailroom of the buffer");
+        size_ += count;
+    };
+    void Buffer::trim_start(size_type count) {
+        if (count > size_)
+            throw std::out_of_range("count must not exceed the size of the buffer");
+        data_ += count;
+        size_ -= count;
+    };
+    void Buffer::trim_end(size_type count) {
+        if (count > size_)
+            throw std::out_of_range("count must not exceed the size of the buffer");
+        size_ -= count;
     };
     
     //
@@ -147,8 +182,8 @@ namespace ngn { namespace experimental {
         return size_;
     }
     bool Buffer::empty() const noexcept {
-        return size_ == 0 || storage_->is_owned ? false : storage_->user_base == nullptr;
-    };*/
+        return size_ == 0;
+    };
     
     //
     // Element Access
@@ -178,10 +213,10 @@ namespace ngn { namespace experimental {
     // Iterators
     //
     const_iterator Buffer::cbegin() const {
-        return Buffer::const_iterator(&(*this)[0]);
+        return Buffer::const_iterator(data_);
     };
     const_iterator Buffer::cend() const {
-        return Buffer::const_iterator(&(*this)[size_]);
+        return Buffer::const_iterator(data_ + size_);
     };
     const_reverse_iterator Buffer::crbegin() const {
         return Buffer::const_reverse_iterator(cend());
@@ -190,13 +225,13 @@ namespace ngn { namespace experimental {
         return Buffer::const_reverse_iterator(cbegin());
     };
     Buffer::iterator Buffer::begin() {
-        return Buffer::iterator(&(*this)[0]);
+        return Buffer::iterator(data_);
     };
     Buffer::const_iterator Buffer::begin() const{
         return cbegin();
     };
     Buffer::iterator Buffer::end() {
-        return Buffer::iterator(&(*this)[size_]);
+        return Buffer::iterator(data_ + size_);
     };
     Buffer::const_iterator Buffer::end() const{
         return cend();
@@ -214,8 +249,7 @@ namespace ngn { namespace experimental {
     //
     
     // copy-assignment
-    Buffer& Buffer::operator=(Buffer other) {
-        //using std::swap;
+    Buffer& Buffer::operator=(Buffer other) noexcept {
         this->swap(other);
         return *this;
     };
@@ -238,7 +272,8 @@ namespace ngn { namespace experimental {
     Buffer::operator bool() const noexcept {
         return data_ != nullptr;
     };
+    
+    Buffer::operator uv_buf_t() const noexcept {
+        return uv_buf_init(reinterpret_cast<char*>(data_), static_cast<unsigned int>(size_));
+    };
 }} // namespace
-
-
-
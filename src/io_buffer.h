@@ -12,9 +12,11 @@
 #include "pointer_iterator.h"
 #include "transform_traits.h"
 
-#include <iostream>
-#include <scoped_allocator>
+#include <uv.h>
+#include <cstddef>
+#include <cstring>
 #include <atomic>
+#include <memory>
 #include <new>
 #include <tq/type_traits.h>
 #include <assert.h>
@@ -84,152 +86,97 @@ namespace ngn { namespace experimental {
     public:
         static struct take_ownership_tag {} take_ownership;
         static struct non_owning_tag {} non_owning;
-        static struct slice_buffer_tag {} slice_buffer;
-
-        struct buffer_header_base2 {
-            std::size_t size;
-            std::atomic_uint ref_count;
-            virtual void release() = 0;
-        };
-        template <class Alloc> struct buffer_header2 : buffer_header_base2 {
-            Alloc allocator;
-            virtual void release() {
-                
-            }
-        };
-        // thou shalt not initialize on the stack
+        static struct read_only_tag {} read_only;
+        
+        // Every buffer that manages memory points at a header,
+        // the header holds the reference count and knows how to release
+        // the memory once the last Buffer referencing it goes away
         struct buffer_header_base {
-            buffer_header_base(bool is_owner, bool is_user, byte* buf, size_t size) :
-            is_owner(is_owner),
-            is_user_base(is_user),
+            buffer_header_base(byte* base, size_t capacity) noexcept :
             ref_count(1),
-            base(buf),
-            size(size) {};
+            base(base),
+            capacity(capacity),
+            read_only(false) {};
             
-            byte * const base;
-            size_t size;
             std::atomic_uint ref_count;
-            bool is_owner;
-            const bool is_user_base;
-            virtual void release() = 0;
+            byte * const base;
+            const size_t capacity;
+            // nothing may be written, there's no headroom/tailroom to grow into
+            bool read_only;
+            virtual void release() noexcept = 0;
+        protected:
+            ~buffer_header_base() = default;
         };
+        
+        template <class AllocT> class wrap_buffer_allocator;
+        
+        // header for buffers we allocated ourselves, the payload lives
+        // directly after the header in the same allocation
         // allows for empty base optimization for allocators
         template <class AllocT>
-        struct buffer_header : buffer_header_base, private AllocT {
+        struct buffer_header final : buffer_header_base, private AllocT {
             using allocator_type = AllocT;
             
-            buffer_header(bool is_owner,
-                          bool is_user,
-                          allocator_type alloc, byte* base, size_t size) :
-            buffer_header_base(is_owner, is_user, base, size),
+            buffer_header(const allocator_type& alloc, byte* base, size_t capacity) noexcept :
+            buffer_header_base(base, capacity),
             allocator_type(alloc) {};
-            virtual void release() {
-                allocator_type::destroy(this);
-                allocator_type::deallocate(this, size);
-            }
-        };
-        // good fucking lord what were you thinking?
-        // jesus christ man clean this shit up
-        // there's just no reason for this hackery to be here
-        template <class AllocT>
-        class wrap_buffer_allocator : public
-        detail::aligned_allocator_adaptor<AllocT, alignof(buffer_header<AllocT>)>{
-            using aligned_allocator_type = detail::aligned_allocator_adaptor<AllocT, alignof(buffer_header<AllocT>)>;
-            using aligned_allocator_traits = std::allocator_traits<aligned_allocator_type>;
-        public:
-            using wrapped_allocator_type = AllocT;
-            using value_type = buffer_header<wrap_buffer_allocator>;
-            using pointer = tq::add_pointer_t<value_type>;
-            using const_pointer = tq::add_const_t<pointer>;
-            using reference = tq::add_lvalue_reference_t<value_type>;
-            using const_reference = tq::add_const_t<reference>;
-            using size_type = typename aligned_allocator_traits::size_type;
-            using difference_type = typename aligned_allocator_traits::difference_type;
             
-            
-            template< class U >
-            wrap_buffer_allocator( const wrap_buffer_allocator<U>& other ) : aligned_allocator_type(static_cast<const typename wrap_buffer_allocator<U>::aligned_allocator_type&>(other)) {};
-            wrap_buffer_allocator(const wrap_buffer_allocator& other) : aligned_allocator_type(static_cast<const aligned_allocator_type&>(other)) {};
-            wrap_buffer_allocator(const wrapped_allocator_type& other) : aligned_allocator_type(other) {};
-            inline pointer allocate(size_type n, const void* hint = 0) {
-                auto ptr = reinterpret_cast<pointer>(aligned_allocator_type::allocate(sizeof(value_type) + n, hint));
-                std::cout << "allocated " << std::hex << ptr << " with capacity: " << std::dec << n << "\n";
-                return ptr;
-            }
-            inline void deallocate(pointer p, size_type n) {
-                std::cout << "deallocating pointer: " << std::hex << p << " with capacity: " << std::dec <<  n << "\n";
-                aligned_allocator_type::deallocate(reinterpret_cast<typename aligned_allocator_type::pointer>(p), sizeof(value_type) + n);
-            }
-            template <class U, class... Args>
-            inline void construct (U* p, Args&&... args) {
-                new (p) U(true, false, *this, reinterpret_cast<byte*>(p) + sizeof(value_type), std::forward<Args>(args)...);
+            const allocator_type& get_allocator() const noexcept {
+                return *this;
             }
-            template <class U>
-            inline void destroy (U* p) {
-                assert(!p->is_user_base);
-                p->~U();
+            virtual void release() noexcept {
+                wrap_buffer_allocator<AllocT>::deallocate(this);
             }
+        };
+        
+        // header for memory the user handed over to us, final so release()
+        // can delete it through its own type
+        template <class Deleter>
+        struct owned_buffer_header final : buffer_header_base {
+            owned_buffer_header(byte* base, size_t capacity, Deleter deleter) :
+            buffer_header_base(base, capacity),
+            deleter(std::move(deleter)) {};
             
+            virtual void release() noexcept {
+                Deleter fn(std::move(deleter));
+                byte* ptr = base;
+                delete this;
+                fn(ptr);
+            }
+            Deleter deleter;
         };
+        
+        // allocates the header and the payload in a single block
+        // the payload is aligned to max_align_t
         template <class AllocT>
-        class wrap_user_buffer_allocator :
-        std::scoped_allocator_adaptor<
-        typename std::allocator_traits<AllocT>::template rebind_traits<wrap_user_buffer_allocator>::allocator_type
-        , AllocT> {
-            using base = std::scoped_allocator_adaptor<
-            typename std::allocator_traits<AllocT>::template rebind_traits<wrap_user_buffer_allocator>::allocator_type
-            , AllocT>;
-            using value_type = typename base::value_type;
-            using pointer = typename base::pointer;
-            using size_type = typename base::size_type;
+        class wrap_buffer_allocator {
+        public:
+            using header_type = buffer_header<AllocT>;
+            using block_type = detail::aligned_storage_t<alignof(std::max_align_t), alignof(std::max_align_t)>;
+            using block_allocator_type = detail::rebind_t<AllocT, block_type>;
+            using block_traits = std::allocator_traits<block_allocator_type>;
             
+            static constexpr size_t header_size =
+                (sizeof(header_type) + sizeof(block_type) - 1) / sizeof(block_type) * sizeof(block_type);
             
-            template <class U, class... Args>
-            inline void construct (U* p, bool is_owner, Args&&... args) {
-                new (p) U(is_owner, true, *this, std::forward<Args>(args)...);
+            static header_type* allocate(const AllocT& alloc, size_t capacity) {
+                block_allocator_type blocks(alloc);
+                block_type* block = block_traits::allocate(blocks, block_count(capacity));
+                byte* base = reinterpret_cast<byte*>(block) + header_size;
+                return ::new (static_cast<void*>(block)) header_type(alloc, base, capacity);
             }
-            template <class U>
-            inline void destroy (U* p) {
-                assert(p->is_user_base);
-                if (p->is_owner) this->inner_allocator().deallocate(p->base, p->size);
-                p->~U();
+            static void deallocate(header_type* header) noexcept {
+                block_allocator_type blocks(header->get_allocator());
+                size_t count = block_count(header->capacity);
+                header->~header_type();
+                block_traits::deallocate(blocks, reinterpret_cast<block_type*>(header), count);
+            }
+        private:
+            static inline size_t block_count(size_t capacity) {
+                return (header_size + capacity + sizeof(block_type) - 1) / sizeof(block_type);
             }
-            
-        };
-        template <class AllocT>
-        static buffer_header_base* make_storage(size_t capacity, AllocT alloc) {
-            using allocator_type = wrap_buffer_allocator<AllocT>;
-            allocator_type allocator(alloc);
-            auto header = allocator.allocate(capacity);
-            allocator.construct(header, capacity);
-            return header;
-        }
-        template <class AllocT>
-        static buffer_header_base* make_storage(bool is_owner, byte* base, size_t capacity, AllocT alloc) {
-            using allocator_type = wrap_user_buffer_allocator<AllocT>;
-            using inner_allocator = typename allocator_type::inner_allocator_type;
-            allocator_type allocator(inner_allocator(alloc), alloc);
-            auto header = allocator.allocate(1);
-            allocator.construct(header, is_owner, base, capacity);
-            return header;
         };
         
-        /*
-         template <class AllocT>
-         static buffer_header_base* make_storage(size_t capacity, AllocT alloc)  {
-         using allocator_type = detail::aligned_allocator_adaptor<AllocT, alignof(buffer_header<std::scoped_allocator_adaptor<AllocT, AllocT>>)>;
-         using scoped_allocator_type = std::scoped_allocator_adaptor<allocator_type, AllocT>;
-         using header_type = buffer_header<scoped_allocator_type>;
-         
-         allocator_type allocator(alloc);
-         scoped_allocator_type scoped_allocator(allocator, alloc);
-         static_assert(alignof(buffer_header<std::scoped_allocator_adaptor<AllocT, AllocT>>) == alignof(header_type), "alignment mismtach");
-         auto block = reinterpret_cast<header_type*>(allocator.allocate(sizeof(header_type) + capacity));
-         auto header = new (reinterpret_cast<header_type*>(block)) header_type(reinterpret_cast<byte*>(block + sizeof(header_type)), true, false, scoped_allocator);
-         
-         return header;
-         }*/
-        
     public:
         //
         // Iterator Traits
@@ -261,10 +208,16 @@ namespace ngn { namespace experimental {
         using size_type         = size_t;
         using difference_type   = iterator_traits::difference_type;
         
+        // empty buffer, does not allocate
+        Buffer() noexcept;
+        
+        // allocates the header and capacity bytes in one block
         template <class AllocT = std::allocator<byte>>
         explicit Buffer(size_type capacity,
                         AllocT alloc = AllocT()) :
-        storage_(make_storage(capacity, alloc)){
+        storage_(wrap_buffer_allocator<AllocT>::allocate(alloc, capacity)),
+        data_(storage_->base),
+        size_(capacity) {
             
         }
         
@@ -272,34 +225,51 @@ namespace ngn { namespace experimental {
         Buffer(const_iterator begin, const_iterator end);
         Buffer(const_iterator begin, size_type size);
         
-        template <class iterator>
+        template <class iterator,
+        class = tq::enable_if_t<!std::is_integral<iterator>::value>>
         Buffer(iterator begin, iterator end)
-        : Buffer(std::distance(begin, end)) {
+        : Buffer(static_cast<size_type>(std::distance(begin, end))) {
             std::copy(begin, end, data_);
         }
         
-        
-        
-        
         // Take Ownership
-        Buffer(std::unique_ptr<value_type>&& source, size_type offset, size_type size);
+        // the memory is released with deleter once the last
+        // buffer referencing it is destroyed
+        Buffer(std::unique_ptr<value_type[]>&& source, size_type offset, size_type size);
+        
+        template <class Deleter = std::default_delete<value_type[]>>
+        Buffer(pointer buffer, size_type offset, size_type size,
+               take_ownership_tag, Deleter deleter = Deleter()) :
+        storage_(new owned_buffer_header<Deleter>(buffer, offset + size, std::move(deleter))),
+        data_(buffer + offset),
+        size_(size) {
+            
+        }
+        // same for memory that must not be written to, like a read only
+        // mapping. The buffer never reports headroom or tailroom, so a
+        // BufferQueue won't copy bytes into it
+        template <class Deleter>
+        Buffer(const_pointer buffer, size_type offset, size_type size,
+               take_ownership_tag, Deleter deleter, read_only_tag) :
+        Buffer(const_cast<pointer>(buffer), offset, size, take_ownership, std::move(deleter)) {
+            storage_->read_only = true;
+        }
         
+        // Wrap user memory without managing it, the caller must keep
+        // the memory alive for as long as any buffer references it
+        Buffer(pointer buffer, size_type offset, size_type size, non_owning_tag) noexcept;
         
         // copy constructor
         Buffer(const Buffer& other) noexcept;
         // move constructor
         Buffer(Buffer&& other) noexcept;
         
-        
-        
-        
-        
         ~Buffer() noexcept;
         
         //
         // Modifiers
         //
-        void swap(Buffer& other);
+        void swap(Buffer& other) noexcept;
         Buffer copy(iterator target_begin, iterator target_end, iterator source_begin, iterator source_end);
         void fill(const_reference value);
         void fill(iterator begin, iterator end, const_reference value);
@@ -308,14 +278,32 @@ namespace ngn { namespace experimental {
         //
         // Views
         //
-        Buffer slice(iterator begin, iterator end);
+        // slices share storage with this buffer, nothing is copied
+        Buffer slice(iterator begin, iterator end) const;
+        Buffer slice(size_type offset, size_type size) const;
         
         //
         // Smart Pointer Methods
         //
-        uint use_count() const noexcept;
+        unsigned use_count() const noexcept;
         bool is_owned() const noexcept;
-        uint ref() noexcept;
+        bool is_unique() const noexcept;
+        
+        //
+        // Headroom/Tailroom
+        //
+        // unused bytes of the underlying storage before and after the view
+        // only write into them if is_unique() is true, otherwise another
+        // buffer may be using those bytes
+        size_type headroom() const noexcept;
+        size_type tailroom() const noexcept;
+        size_type capacity() const noexcept;
+        // grow the view into the headroom/tailroom
+        void prepend(size_type count);
+        void append(size_type count);
+        // shrink the view
+        void trim_start(size_type count);
+        void trim_end(size_type count);
         
         //
         // Container Methods
@@ -353,18 +341,15 @@ namespace ngn { namespace experimental {
         //
         bool operator==(const Buffer& rhs) const;
         bool operator!=(const Buffer& rhs) const;
-        Buffer& operator=(Buffer other);
+        Buffer& operator=(Buffer other) noexcept;
         const_reference operator[](size_t index) const;
         reference operator[](size_t index);
         operator bool() const noexcept;
+        operator uv_buf_t() const noexcept;
         
-        //private:
     private:
-        friend constexpr size_t managed_buffer_space();
-        static inline size_t managed_buffer_size(size_t capacity);
-//        Buffer(buffer_header* header, iterator begin, iterator end, slice_buffer_tag);
-        Buffer(pointer buffer, size_type offset, size_type size, take_ownership_tag);
-        Buffer(pointer buffer, size_type offset, size_type size, non_owning_tag);
+        Buffer(buffer_header_base* storage, pointer data, size_type size) noexcept;
+        void release() noexcept;
         buffer_header_base* storage_;
         pointer data_;
         size_type size_;
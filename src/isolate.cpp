@@ -7,3 +7,55 @@
 //
 
 #include "isolate.h"
+#include "handle.h"
+#include "timer_wheel.h"
+#include "uring.h"
+
+namespace ngn {
+    message_sink& isolate::messages() {
+        if (m_messages == nullptr)
+            m_messages = new message_sink(*this);
+        return *m_messages;
+    };
+    
+    void isolate::add_pending() {
+        if (m_pending++ == 0)
+            messages().ref();
+    };
+    
+    void isolate::remove_pending() {
+        assert(m_pending > 0);
+        if (--m_pending == 0)
+            messages().unref();
+    };
+    
+    timer_wheel& isolate::timers() {
+        if (m_timers == nullptr)
+            m_timers = new timer_wheel(m_loop.handle());
+        return *m_timers;
+    };
+    
+    uring* isolate::io_uring() {
+        if (!m_uring_probed) {
+            m_uring_probed = true;
+            m_uring = uring::create(*this);
+        }
+        return m_uring;
+    };
+    
+    isolate::~isolate() {
+        // allow event loop to cleanup
+        m_loop.run();
+        // the closes have to go through the loop before the memory goes
+        if (m_messages)
+            m_messages->close();
+        if (m_timers)
+            m_timers->close();
+        if (m_uring)
+            m_uring->close();
+        m_loop.run();
+        delete m_messages;
+        delete m_timers;
+        delete m_uring;
+    };
+}
@@ -10,11 +10,16 @@
 #define __ngn__isolate__
 
 #include "eventloop.h"
+#include "buffer_pool.h"
 
 #include <uv.h>
 #include <thread>
 
 namespace ngn {
+    class message_sink;
+    class timer_wheel;
+    class uring;
+    
     class isolate {
     public:
         class isolate_manager {
@@ -41,17 +46,39 @@ namespace ngn {
         };
 
         
+    private:
+        static isolate_manager& manager() {
+            static isolate_manager instance;
+            return instance;
+        };
     public:
+        // the calling thread's isolate, created on first use
         static isolate& instance(bool use_default_loop = false) {
-            static isolate_manager manager;
-            return *manager.get(use_default_loop);
+            return *manager().get(use_default_loop, true);
         };
-        isolate(uv_loop_t* handle) : m_loop(handle), m_thread_id(std::this_thread::get_id()) {
+        // tears down the calling thread's isolate, if it has one
+        static void release() {
+            if (isolate* handle = manager().get())
+                manager().release(handle);
+        };
+        isolate(uv_loop_t* handle) :
+            m_loop(handle),
+            m_thread_id(std::this_thread::get_id()),
+            m_messages(nullptr),
+            m_pending(0),
+            m_timers(nullptr),
+            m_uring(nullptr),
+            m_uring_probed(false) {
             
         }
         isolate() :
             m_loop(EventLoop()),
-            m_thread_id(std::this_thread::get_id()) {
+            m_thread_id(std::this_thread::get_id()),
+            m_messages(nullptr),
+            m_pending(0),
+            m_timers(nullptr),
+            m_uring(nullptr),
+            m_uring_probed(false) {
         };
         isolate(const isolate&) = delete;
         isolate(isolate&&) = delete;
@@ -62,15 +89,40 @@ namespace ngn {
         EventLoop& event_loop() {
             return m_loop;
         }
-        ~isolate() {
-            // allow event loop to cleanup
-            m_loop.run();
-            
+        // read buffers for every stream on this isolate
+        experimental::BufferPool& buffer_pool() {
+            return m_buffer_pool;
         }
         
+        //
+        // Cross-thread Messages
+        //
+        // callbacks posted here from any thread run on this isolate's loop,
+        // created on first use which has to be on the loop thread
+        message_sink& messages();
+        // keeps the loop alive while results are still due from other
+        // threads, loop thread only
+        void add_pending();
+        void remove_pending();
+        
+        // every Timer on this isolate, created on first use
+        timer_wheel& timers();
+        
+        // io_uring file engine, set up on first use. nullptr when the
+        // build or the kernel has none, file I/O then stays on libuv
+        uring* io_uring();
+        
+        ~isolate();
+        
     private:
         EventLoop m_loop;
         const std::thread::id m_thread_id;
+        experimental::BufferPool m_buffer_pool;
+        message_sink* m_messages;
+        size_t m_pending;
+        timer_wheel* m_timers;
+        uring* m_uring;
+        bool m_uring_probed;
     };
 }
 
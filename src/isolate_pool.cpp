@@ -0,0 +1,140 @@
+//
+//  isolate_pool.cpp
+//  ngn
+//
+//
+//
+
+#include "isolate_pool.h"
+#include "isolate.h"
+#include "handle.h"
+
+#include <condition_variable>
+#include <mutex>
+
+namespace ngn {
+    //
+    // Worker
+    //
+    
+    // One thread, one isolate. Tasks from other threads come in through a
+    // message_sink, which is kept referenced so an idle worker stays up
+    // until shutdown unrefs it; the loop then exits by itself once whatever
+    // the tasks opened has been closed too
+    class isolate_pool::worker {
+    public:
+        worker() : m_ready(false), m_stopping(false), m_posting(0), m_sink(nullptr) {
+            m_thread = std::thread([this] { run(); });
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_ready_cond.wait(lock, [this] { return m_ready; });
+        };
+        ~worker() {
+            join();
+        };
+        
+        bool post(task fn) {
+            // announce ourselves before checking so run() can't tear the
+            // sink down between the check and the post
+            m_posting.fetch_add(1);
+            bool posted = !m_stopping.load();
+            if (posted)
+                m_sink->post(bind(std::move(fn)));
+            m_posting.fetch_sub(1);
+            return posted;
+        };
+        
+        void stop(const task& on_stop) {
+            m_posting.fetch_add(1);
+            if (!m_stopping.exchange(true)) {
+                m_sink->post([this, on_stop] {
+                    if (on_stop)
+                        on_stop(*m_isolate);
+                    m_sink->unref();
+                });
+            }
+            m_posting.fetch_sub(1);
+        };
+        
+        void join() {
+            if (m_thread.joinable())
+                m_thread.join();
+        };
+        
+    private:
+        message_sink::callback bind(task fn) {
+            return [this, fn] { fn(*m_isolate); };
+        };
+        
+        void run() {
+            m_isolate = &isolate::instance();
+            std::unique_ptr<message_sink> sink(new message_sink(*m_isolate));
+            sink->ref();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_sink = sink.get();
+                m_ready = true;
+            }
+            m_ready_cond.notify_one();
+            
+            m_isolate->event_loop().run();
+            
+            // m_stopping is set, wait out posts that got past the check
+            while (m_posting.load() != 0)
+                std::this_thread::yield();
+            sink->close();
+            // finish the close before the memory goes, the sink's
+            // destructor runs whatever arrived late
+            m_isolate->event_loop().run();
+            sink.reset();
+            isolate::release();
+        };
+        
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_ready_cond;
+        bool m_ready;
+        std::atomic<bool> m_stopping;
+        std::atomic<size_t> m_posting;
+        message_sink* m_sink;
+        isolate* m_isolate;
+    };
+    
+    //
+    // Pool
+    //
+    
+    isolate_pool::isolate_pool(size_t size) : m_next(0) {
+        if (size == 0)
+            size = 1;
+        m_workers.reserve(size);
+        for (size_t i = 0; i < size; ++i)
+            m_workers.emplace_back(new worker());
+    };
+    
+    isolate_pool::~isolate_pool() {
+        shutdown();
+        join();
+    };
+    
+    bool isolate_pool::broadcast(const task& fn) {
+        bool posted = true;
+        for (auto& w : m_workers)
+            posted = w->post(fn) && posted;
+        return posted;
+    };
+    
+    bool isolate_pool::post(task fn) {
+        size_t index = m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+        return m_workers[index]->post(std::move(fn));
+    };
+    
+    void isolate_pool::shutdown(task on_stop) {
+        for (auto& w : m_workers)
+            w->stop(on_stop);
+    };
+    
+    void isolate_pool::join() {
+        for (auto& w : m_workers)
+            w->join();
+    };
+}
@@ -0,0 +1,63 @@
+//
+//  isolate_pool.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__isolate_pool__
+#define __ngn__isolate_pool__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace ngn {
+    class isolate;
+    
+    // A fixed set of worker threads, each owning an isolate and running its
+    // event loop. Listeners are spread over the workers either by opening
+    // one per worker (broadcast, with SO_REUSEPORT on the socket) or by
+    // accepting on one loop and handing each connection to post()
+    class isolate_pool {
+    public:
+        typedef std::function<void(isolate&)> task;
+        
+        // starts the workers and waits until every loop is accepting tasks
+        explicit isolate_pool(size_t size = std::thread::hardware_concurrency());
+        isolate_pool(const isolate_pool&) = delete;
+        isolate_pool& operator=(const isolate_pool&) = delete;
+        // shuts down and joins
+        ~isolate_pool();
+        
+        size_t size() const {
+            return m_workers.size();
+        };
+        
+        // runs fn on every worker's loop thread
+        // returns false once the pool is shutting down
+        bool broadcast(const task& fn);
+        
+        // runs fn on the next worker in round robin order
+        // returns false once the pool is shutting down
+        bool post(task fn);
+        
+        // graceful shutdown: every worker runs the tasks already queued, then
+        // on_stop (the place to close its listeners), and its loop exits once
+        // the handles still open there are done. doesn't block
+        void shutdown(task on_stop = nullptr);
+        
+        // waits for every worker thread to exit
+        void join();
+        
+    private:
+        class worker;
+        
+        std::vector<std::unique_ptr<worker>> m_workers;
+        std::atomic<size_t> m_next;
+    };
+}
+
+#endif /* defined(__ngn__isolate_pool__) */
@@ -0,0 +1,120 @@
+//
+//  mpsc_queue.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__mpsc_queue__
+#define __ngn__mpsc_queue__
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ngn {
+    //
+    // Bounded multi-producer single-consumer queue (Dmitry Vyukov's ring)
+    // Every cell is allocated up front and carries a sequence number that
+    // says whose turn it is, producers claim a cell with one CAS on the tail
+    // and never wait on each other or on the consumer. A full queue is
+    // reported to the producer rather than blocking it
+    //
+    template <typename T>
+    class mpsc_queue {
+        struct cell {
+            std::atomic<size_t> sequence;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+            T* get() {
+                return reinterpret_cast<T*>(&storage);
+            };
+        };
+        static const size_t cache_line = 64;
+    public:
+        typedef T value_type;
+
+        // capacity is rounded up to a power of two
+        explicit mpsc_queue(size_t capacity = 1024) : m_enqueue(0), m_dequeue(0) {
+            size_t size = 2;
+            while (size < capacity)
+                size <<= 1;
+            m_mask = size - 1;
+            m_cells.reset(new cell[size]);
+            for (size_t i = 0; i < size; ++i)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        };
+        mpsc_queue(const mpsc_queue&) = delete;
+        mpsc_queue& operator=(const mpsc_queue&) = delete;
+        ~mpsc_queue() {
+            T value;
+            while (try_pop(value));
+        };
+
+        size_t capacity() const {
+            return m_mask + 1;
+        };
+
+        // any thread; false when the queue is full
+        template <typename U>
+        bool try_push(U&& value) {
+            cell* target;
+            size_t pos = m_enqueue.load(std::memory_order_relaxed);
+            for (;;) {
+                target = &m_cells[pos & m_mask];
+                size_t seq = target->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0) {
+                    if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = m_enqueue.load(std::memory_order_relaxed);
+                }
+            }
+            // the cell is ours now, a throwing constructor would leave it
+            // claimed forever so only move in things that can't throw
+            new (target->get()) T(std::forward<U>(value));
+            target->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        };
+
+        // consumer thread only; false when there's nothing published yet
+        bool try_pop(T& value) {
+            cell& target = m_cells[m_dequeue & m_mask];
+            size_t seq = target.sequence.load(std::memory_order_acquire);
+            if (seq != m_dequeue + 1)
+                return false;
+            T* item = target.get();
+            value = std::move(*item);
+            item->~T();
+            target.sequence.store(m_dequeue + m_mask + 1, std::memory_order_release);
+            ++m_dequeue;
+            return true;
+        };
+
+        // consumer thread only; a producer that has claimed but not yet
+        // published a cell counts as empty
+        bool empty() const {
+            const cell& target = m_cells[m_dequeue & m_mask];
+            return target.sequence.load(std::memory_order_acquire) != m_dequeue + 1;
+        };
+
+    private:
+        std::unique_ptr<cell[]> m_cells;
+        size_t m_mask;
+        // producers hammer the tail, keep it off the consumer's line
+        char m_pad0[cache_line];
+        std::atomic<size_t> m_enqueue;
+        char m_pad1[cache_line];
+        size_t m_dequeue;
+    };
+}
+
+#endif /* defined(__ngn__mpsc_queue__) */
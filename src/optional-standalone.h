@@ -52,7 +52,7 @@ namespace ngn {
     using std::is_nothrow_move_constructible;
     using std::reference_wrapper;
 
-# if (defined __GNUC__) && (__GNUC__ >= 4) && (__GNUC_MINOR__ >= 8)
+# if (defined __GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4) && (__GNUC_MINOR__ >= 8))
     // leave it; our metafunctions are already defined.
 # elif (defined __clang__) && ((__clang_major__ > 3) || (__clang_major__ == 3) && (__clang_minor__ >= 3))
     // leave it; our metafunctions are already defined.
@@ -62,7 +62,7 @@ namespace ngn {
     using is_trivially_destructible = typename std::has_trivial_destructor<T>;
     
     
-#  if (defined __GNUC__) && (__GNUC__ >= 4) && (__GNUC_MINOR__ >= 7)
+#  if (defined __GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4) && (__GNUC_MINOR__ >= 7))
     // leave it; remaining metafunctions are already defined.
 #  elif defined __clang__
     // leave it; remaining metafunctions are already defined.
@@ -12,6 +12,15 @@
 #ifndef NGN_USE_BOOST
 #ifdef NGN_USE_OPTIONAL_STANDALONE
 #include "optional-standalone.h"
+#else
+// the compiler ships optional
+#include <experimental/optional>
+namespace ngn {
+    using std::experimental::optional;
+    using std::experimental::nullopt;
+    using std::experimental::nullopt_t;
+    using std::experimental::make_optional;
+}
 #endif
 #else 
 namespace ngn {
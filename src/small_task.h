@@ -0,0 +1,19 @@
+//
+//  small_task.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__small_task__
+#define __ngn__small_task__
+
+#include "inplace_function.h"
+
+namespace ngn {
+    // Queued void() work: captures up to six pointers stay inline so
+    // queueing a lambda doesn't allocate, bigger ones go to the heap
+    typedef inplace_function<void(), 6 * sizeof(void*), true> small_task;
+}
+
+#endif /* defined(__ngn__small_task__) */
@@ -12,7 +12,11 @@
 #include <functional>
 #include <cmath>
 #include <list>
+#include <deque>
+#include <vector>
+#include <stdexcept>
 #include "eventloop.h"
+#include "isolate.h"
 #include "event.h"
 #include "encoding.h"
 #include "buffer.h"
@@ -40,8 +44,8 @@ namespace ngn{
     
     template<class ChunkType>
     struct stream_traits {
-        typedef std::vector<ChunkType> chunk_type;
-        typedef chunk_type buffer_type;
+        typedef ChunkType chunk_type;
+        typedef std::deque<ChunkType> buffer_type;
         static const size_t high_water_mark = 16;
         static const size_t buffer_reserve = 0;
         static const bool object_mode = true;
@@ -50,7 +54,7 @@ namespace ngn{
     template<>
     struct stream_traits<Buffer>{
         typedef Buffer chunk_type;
-        typedef std::vector<Buffer> buffer_type;
+        typedef std::deque<Buffer> buffer_type;
         static const size_t high_water_mark = 16 * 1024;
         static const size_t buffer_reserve = 0;
         static const bool object_mode = false;
@@ -60,7 +64,7 @@ namespace ngn{
     struct stream_traits<std::string>
     {
         typedef std::string chunk_type;
-        typedef std::vector<Buffer> buffer_type;
+        typedef std::deque<std::string> buffer_type;
         static const size_t high_water_mark = 16 * 1024;
         static const size_t buffer_reserve = 0;
         static const bool object_mode = false;
@@ -70,56 +74,161 @@ namespace ngn{
     struct stream_traits<std::u16string>
     {
         typedef std::u16string chunk_type;
-        typedef std::vector<Buffer> buffer_type;
+        typedef std::deque<std::u16string> buffer_type;
         static const size_t high_water_mark = (16 * 1024) / 2;
         static const size_t buffer_reserve = 0;
         static const bool object_mode = false;
     };
     
+    // the Buffer the I/O handles and the BufferPool deal in
+    template<>
+    struct stream_traits<experimental::Buffer>{
+        typedef experimental::Buffer chunk_type;
+        typedef std::deque<experimental::Buffer> buffer_type;
+        static const size_t high_water_mark = 16 * 1024;
+        static const size_t buffer_reserve = 0;
+        static const bool object_mode = false;
+    };
+    
     typedef stream_traits<std::string> ascii_stream_traits;
     typedef stream_traits<std::string> utf_stream_traits;
     typedef stream_traits<std::u16string> utf16_stream_traits;
     
-    template <class ChunkType, class Traits, class Alloc> class WritableStreamBase;
-    
+    template <class ChunkType = Buffer, class Traits = stream_traits<ChunkType>, class Alloc = std::allocator<ChunkType>>
+    class WritableStream;
     
+
     
+    // removes the first size units from the front of list and returns them
+    // as one chunk. reads that end inside the first chunk take it (or a
+    // slice of it) without copying, only reads across chunks copy
     template <class T, class ListT>
-    T splice(ListT& List, size_t size);
+    T splice(ListT& list, size_t size) {
+        T& head = list.front();
+        if (size == head.size()) {
+            T ret(std::move(head));
+            list.pop_front();
+            return ret;
+        }
+        if (size < head.size()) {
+            T ret = head.substr(0, size);
+            head.erase(0, size);
+            return ret;
+        }
+        T ret;
+        ret.reserve(size);
+        while (size > 0 && !list.empty()) {
+            T& chunk = list.front();
+            if (chunk.size() <= size) {
+                ret.append(chunk);
+                size -= chunk.size();
+                list.pop_front();
+            } else {
+                ret.append(chunk, 0, size);
+                chunk.erase(0, size);
+                size = 0;
+            }
+        }
+        return ret;
+    }
     
     template<>
-    Buffer splice<Buffer, vector<Buffer>>(vector<Buffer>& list, size_t size) {
-        Buffer buf(size);
-        auto list_begin = list.begin();
-        auto list_end = list.end();
-        auto output_begin = buf.begin();
-        auto output_end = buf.end();
-        for(auto i = list_begin; i != list_end && output_begin != output_end; i++) {
-            auto buf_size = i->size();
-            auto chunk_size = std::min(buf_size, size);
-            output_begin = std::copy_n(i->begin(), chunk_size, output_begin);
-            // buffer is flushed
-            if (chunk_size == buf_size) {
-                list_begin++;
+    inline Buffer splice<Buffer, std::deque<Buffer>>(std::deque<Buffer>& list, size_t size) {
+        Buffer& head = list.front();
+        auto head_size = head.size();
+        if (size == head_size) {
+            Buffer ret(std::move(head));
+            list.pop_front();
+            return ret;
+        }
+        if (size < head_size) {
+            Buffer ret = head.slice(head.begin(), head.begin() + size);
+            head = head.slice(head.begin() + size, head.end());
+            return ret;
+        }
+        // crosses chunk boundaries, the only case that copies
+        Buffer ret(size);
+        auto output = ret.begin();
+        while (size > 0 && !list.empty()) {
+            Buffer& chunk = list.front();
+            auto chunk_size = std::min(chunk.size(), size);
+            output = std::copy_n(chunk.cbegin(), chunk_size, output);
+            size -= chunk_size;
+            if (chunk_size == chunk.size()) {
+                list.pop_front();
             } else {
-                *i = i->slice(i->begin() + chunk_size, i->end());
+                chunk = chunk.slice(chunk.begin() + chunk_size, chunk.end());
             }
         }
-        list.erase(list_begin, list_end);
-        return buf;
+        return ret;
+    }
+    
+    template<>
+    inline experimental::Buffer splice<experimental::Buffer, std::deque<experimental::Buffer>>(std::deque<experimental::Buffer>& list, size_t size) {
+        experimental::Buffer& head = list.front();
+        if (size == head.size()) {
+            experimental::Buffer ret(std::move(head));
+            list.pop_front();
+            return ret;
+        }
+        if (size < head.size()) {
+            experimental::Buffer ret = head.slice(0, size);
+            head.trim_start(size);
+            return ret;
+        }
+        // crosses chunk boundaries, the only case that copies
+        experimental::Buffer ret(size);
+        auto output = ret.begin();
+        while (size > 0 && !list.empty()) {
+            experimental::Buffer& chunk = list.front();
+            auto chunk_size = std::min(chunk.size(), size);
+            output = std::copy_n(chunk.cbegin(), chunk_size, output);
+            size -= chunk_size;
+            if (chunk_size == chunk.size()) {
+                list.pop_front();
+            } else {
+                chunk.trim_start(chunk_size);
+            }
+        }
+        return ret;
+    }
+    
+    // scatter version, never copies: whole chunks move into the chain and
+    // the last one is sliced if the read ends inside it
+    template<>
+    inline BufferChain splice<BufferChain, std::deque<Buffer>>(std::deque<Buffer>& list, size_t size) {
+        BufferChain ret;
+        while (size > 0 && !list.empty()) {
+            Buffer& chunk = list.front();
+            if (chunk.size() <= size) {
+                size -= chunk.size();
+                ret.push_back(std::move(chunk));
+                list.pop_front();
+            } else {
+                ret.push_back(chunk.slice(chunk.begin(), chunk.begin() + size));
+                chunk = chunk.slice(chunk.begin() + size, chunk.end());
+                size = 0;
+            }
+        }
+        return ret;
     }
     
     
     template <class ChunkType = Buffer, class Traits = stream_traits<ChunkType>, class Alloc = std::allocator<ChunkType>>
     class ReadableStream {
+    public:
         typedef ChunkType chunk_type;
         typedef Traits traits_type;
         typedef typename traits_type::buffer_type buffer_type;
         typedef size_t size_type;
         typedef Alloc allocator_type;
+        // what pipe() can hand to _pipe()
+        typedef WritableStream<chunk_type, traits_type, allocator_type> writable_type;
         
-        ReadableStream();
-        ReadableStream(allocator_type allocator);
+        explicit ReadableStream(size_type high_water_mark = traits_type::high_water_mark,
+                                allocator_type allocator = allocator_type()) :
+            allocator(allocator),
+            high_watermark(high_water_mark) {};
         
         // no copy constructor
         ReadableStream(const ReadableStream&) = delete;
@@ -127,6 +236,8 @@ namespace ngn{
         // default move
         ReadableStream(ReadableStream&&) = default;
         
+        virtual ~ReadableStream() = default;
+        
         // constants
         static const bool object_mode = traits_type::object_mode;
         
@@ -137,7 +248,254 @@ namespace ngn{
         Event<> onClose;
         Event<std::exception> onError;
         
+        // returns the next n bytes (or the next object in object mode)
+        // a read that ends inside the first queued chunk is a slice of it
         optional<chunk_type> read(size_type n = 0) {
+            return readAs<chunk_type>(n);
+        }
+        
+        // like read(n) but the bytes come back as a chain of slices of the
+        // queued chunks, so nothing is copied even across chunk boundaries
+        template <class T = chunk_type,
+                  class = typename std::enable_if<std::is_same<T, Buffer>::value>::type>
+        optional<BufferChain> readv(size_type n) {
+            return readAs<BufferChain>(n);
+        }
+        
+        // feeds a chunk to the consumer, returns false once the queue is
+        // at the high water mark and _read should stop producing
+        bool push(chunk_type chunk) {
+            return addChunk(std::move(chunk), false);
+        }
+        // signals the end of the data, like push(null) in node
+        bool push(nullopt_t) {
+            is_reading = false;
+            if (!is_ended)
+                onEofChunk();
+            return false;
+        }
+        // puts a chunk back at the front, for parsers that read too much
+        bool unshift(chunk_type chunk) {
+            return addChunk(std::move(chunk), true);
+        }
+        
+        void resume() {
+            if (is_flowing)
+                return;
+            is_flowing = true;
+            if (!is_resume_scheduled) {
+                is_resume_scheduled = true;
+                nextTick([this] {
+                    is_resume_scheduled = false;
+                    if (!is_reading)
+                        read(0);
+                    flow();
+                    if (is_flowing && !is_reading)
+                        read(0);
+                });
+            }
+        }
+        void pause() {
+            is_flowing = false;
+        }
+        
+        size_type length() const {
+            return length_;
+        }
+        size_type high_water_mark() const {
+            return high_watermark;
+        }
+        bool is_paused() const {
+            return !is_flowing;
+        }
+        
+        //
+        // Piping
+        //
+        // Everything read from here is written to dest. When dest.write()
+        // returns false the source pauses until every destination that
+        // pushed back has emitted onDrain. With end set, dest.end() is
+        // called when the source ends. An error or finish on dest unpipes
+        // it, an error on the source is passed on to every destination.
+        // dest has to stay alive until it's unpiped
+        //
+        template <class Destination>
+        Destination& pipe(Destination& dest, bool end = true) {
+            // a source that can move the bytes by itself gets dest to itself
+            if (pipes.empty() && takeOverPipe(dest, end, std::is_base_of<writable_type, Destination>()))
+                return dest;
+            pipes.emplace_back();
+            PipeTarget& target = pipes.back();
+            target.destination = &dest;
+            target.end_with_source = end;
+            target.write = [&dest](const chunk_type& chunk) {
+                return dest.write(chunk);
+            };
+            target.end = [&dest] {
+                dest.end();
+            };
+            target.error = [&dest](const std::exception& e) {
+                dest.onError(std::exception(e));
+            };
+            auto drain = dest.onDrain([this, &dest] { pipeOnDrain(&dest); });
+            auto error = dest.onError([this, &dest](std::exception) { unpipe(dest); });
+            auto finish = dest.onFinish([this, &dest] { unpipe(dest); });
+            target.disconnect = [&dest, drain, error, finish] {
+                dest.onDrain.off(drain);
+                dest.onError.off(error);
+                dest.onFinish.off(finish);
+            };
+            
+            if (!is_piping) {
+                is_piping = true;
+                pipe_data = onData([this](const chunk_type& chunk) { pipeOnData(chunk); });
+                pipe_end = onEnd([this] { pipeOnEnd(); });
+                pipe_error = onError([this](std::exception e) { pipeOnError(e); });
+            }
+            if (is_end_emitted)
+                nextTick([this] { pipeOnEnd(); });
+            else if (!is_flowing)
+                resume();
+            return dest;
+        }
+        
+        template <class Destination>
+        void unpipe(Destination& dest) {
+            for (auto& target : pipes) {
+                if (target.destination == &dest && !target.removed) {
+                    removePipe(target);
+                    break;
+                }
+            }
+            sweepPipes();
+        }
+        void unpipe() {
+            for (auto& target : pipes) {
+                if (!target.removed)
+                    removePipe(target);
+            }
+            sweepPipes();
+        }
+        
+    protected:
+        // asks the implementation for about count more bytes, it answers
+        // with push(), now or later
+        virtual void _read(size_type count) = 0;
+        
+        // lets a source take over a pipe() into dest, e.g. to move the bytes
+        // in the kernel. returns false to get the regular read/write loop
+        virtual bool _pipe(writable_type& dest, bool end) {
+            return false;
+        }
+    private:
+        template <class Destination>
+        bool takeOverPipe(Destination& dest, bool end, std::true_type) {
+            return _pipe(dest, end);
+        }
+        template <class Destination>
+        bool takeOverPipe(Destination&, bool, std::false_type) {
+            return false;
+        }
+        
+        struct PipeTarget {
+            const void* destination = nullptr;
+            inplace_function<bool(const chunk_type&)> write;
+            inplace_function<void()> end;
+            inplace_function<void(const std::exception&)> error;
+            // drops our listeners from the destination's events
+            inplace_function<void()> disconnect;
+            bool end_with_source = true;
+            // counted in awaiting_drain
+            bool is_awaiting_drain = false;
+            // unpiped while we were walking the list, erased afterwards
+            bool removed = false;
+        };
+        
+        void pipeOnData(const chunk_type& chunk) {
+            ++pipes_walking;
+            for (auto& target : pipes) {
+                if (target.removed)
+                    continue;
+                if (!target.write(chunk) && !target.is_awaiting_drain) {
+                    target.is_awaiting_drain = true;
+                    ++awaiting_drain;
+                }
+            }
+            --pipes_walking;
+            if (awaiting_drain > 0)
+                pause();
+            sweepPipes();
+        }
+        void pipeOnDrain(const void* dest) {
+            for (auto& target : pipes) {
+                if (target.destination == dest && target.is_awaiting_drain) {
+                    target.is_awaiting_drain = false;
+                    --awaiting_drain;
+                }
+            }
+            if (awaiting_drain == 0 && !pipes.empty() && !is_flowing) {
+                is_flowing = true;
+                flow();
+                // ran dry, ask for more
+                if (is_flowing && !is_reading)
+                    read(0);
+            }
+        }
+        void pipeOnEnd() {
+            ++pipes_walking;
+            for (auto& target : pipes) {
+                if (target.removed)
+                    continue;
+                // ending may finish it right away, which unpipes it
+                if (target.end_with_source)
+                    target.end();
+                if (!target.removed)
+                    removePipe(target);
+            }
+            --pipes_walking;
+            sweepPipes();
+        }
+        void pipeOnError(const std::exception& e) {
+            ++pipes_walking;
+            for (auto& target : pipes) {
+                if (target.removed)
+                    continue;
+                // our own error listener is gone first, so this doesn't
+                // come back around
+                removePipe(target);
+                target.error(e);
+            }
+            --pipes_walking;
+            sweepPipes();
+        }
+        void removePipe(PipeTarget& target) {
+            target.disconnect();
+            if (target.is_awaiting_drain) {
+                target.is_awaiting_drain = false;
+                --awaiting_drain;
+            }
+            target.removed = true;
+        }
+        void sweepPipes() {
+            if (pipes_walking > 0)
+                return;
+            pipes.remove_if([](const PipeTarget& target) { return target.removed; });
+            if (pipes.empty()) {
+                if (is_piping) {
+                    is_piping = false;
+                    onData.off(pipe_data);
+                    onEnd.off(pipe_end);
+                    onError.off(pipe_error);
+                    pause();
+                }
+            } else if (awaiting_drain == 0 && !is_flowing) {
+                // whoever pushed back has been unpiped
+                resume();
+            }
+        }
+        
+        template <class Result>
+        optional<Result> readAs(size_type n) {
             auto orig = n;
             if (n > 0)
                 is_readable_emitted = false;
@@ -146,7 +504,7 @@ namespace ngn{
             // already have a bunch of data in the buffer, then just trigger
             // the 'readable' event and move on.
             if (n == 0 && needs_readable
-                && (length_ > high_watermark || is_ended)) {
+                && (length_ >= high_watermark || is_ended)) {
                 if (length_ == 0 && is_ended) {
                     endReadable();
                 } else {
@@ -157,10 +515,12 @@ namespace ngn{
             
             n = howMuchToRead(n);
             
+            // if we've ended, and we're now clear, then finish it up.
             if (n == 0 && is_ended) {
                 if (length_ == 0) {
                     endReadable();
                 }
+                return nullopt;
             }
             // All the actual chunk generation logic needs to be
             // *below* the call to _read.  The reason is that in certain
@@ -211,7 +571,10 @@ namespace ngn{
             if (do_read && !is_reading)
                 n = howMuchToRead(orig);
             
-            optional<chunk_type> ret = n > 0 ? nullopt /* from list */ : nullopt;
+            optional<Result> ret;
+            // object mode asks for one even when nothing is queued
+            if (n > 0 && length_ > 0)
+                ret = fromList<Result>(n);
             if (!ret) {
                 needs_readable = true;
                 n = 0;
@@ -228,55 +591,131 @@ namespace ngn{
                 endReadable();
             }
             
-            if (orig)
-                onData(*ret);
+            if (ret)
+                emitData(*ret);
             
             return ret;
         }
         
-        void resume();
-        void pause();
+        // n is at most length_
+        template <class Result>
+        Result fromList(size_type n) {
+            return fromList<Result>(n, std::integral_constant<bool, object_mode>());
+        }
+        template <class Result>
+        Result fromList(size_type n, std::true_type) {
+            Result ret(std::move(buffer.front()));
+            buffer.pop_front();
+            return ret;
+        }
+        template <class Result>
+        Result fromList(size_type n, std::false_type) {
+            return splice<Result>(buffer, n);
+        }
         
+        void emitData(const chunk_type& chunk) {
+            onData(chunk);
+        }
+        template <class T = chunk_type,
+                  class = typename std::enable_if<std::is_same<T, Buffer>::value>::type>
+        void emitData(const BufferChain& chain) {
+            for (auto& chunk : chain)
+                onData(chunk);
+        }
         
-    protected:
-        void _read(size_t count);
-    private:
-        optional<chunk_type> fromList(size_type n) {
-            typedef typename chunk_type::pointer chunk_pointer;
-            if (buffer.empty())
-                return nullopt;
-            
-            // assume buffer here
-            n = std::min(n, length_);
-            chunk_type ret(n);
-            auto chunk_begin = ret.begin();
-            auto chunk_end = ret.end();
-            size_t flushed = 0;
-            for (auto i : buffer) {
-                size_t buf_size = i->size();
-                size_t chunk_size = std::min(buf_size, n);
-                std::copy_n(i->cbegin(), chunk_size, chunk_begin);
-                chunk_begin += chunk_size;
-                n -= chunk_size;
-                if (buf_size == chunk_size) flushed += 1;
-                else {
-                    i = i->slice(i->cbegin() + chunk_size, i->cend());
-                }
-                if (chunk_begin >= chunk_end) break;
+        static size_type chunkLength(const chunk_type&, std::true_type) {
+            return 1;
+        }
+        static size_type chunkLength(const chunk_type& chunk, std::false_type) {
+            return chunk.size();
+        }
+        static size_type chunkLength(const chunk_type& chunk) {
+            return chunkLength(chunk, std::integral_constant<bool, object_mode>());
+        }
+        
+        bool addChunk(chunk_type chunk, bool add_to_front) {
+            size_type len = chunkLength(chunk);
+            if (len == 0) {
+                if (!add_to_front)
+                    is_reading = false;
+                return needMoreData();
             }
-            if (flushed)
-                buffer.remove(buffer.begin(), buffer.begin()+flushed);
-            return ret;
+            if (is_ended && !add_to_front) {
+                onError(std::runtime_error("stream.push() after EOF"));
+                return false;
+            }
+            if (is_end_emitted && add_to_front) {
+                onError(std::runtime_error("stream.unshift() after end event"));
+                return false;
+            }
+            if (!add_to_front)
+                is_reading = false;
             
+            // if we want the data now, just emit it.
+            if (is_flowing && length_ == 0 && !is_sync) {
+                onData(chunk);
+                read(0);
+            } else {
+                length_ += len;
+                if (add_to_front)
+                    buffer.push_front(std::move(chunk));
+                else
+                    buffer.push_back(std::move(chunk));
+                if (needs_readable)
+                    emitReadable();
+            }
+            maybeReadMore();
+            return needMoreData();
+        }
+        
+        // if it's past the high water mark, we can push in some more.
+        // Also, if we have no data yet, we can stand some
+        // more bytes.  This is to work around cases where hwm=0,
+        // such as the repl.
+        bool needMoreData() const {
+            return !is_ended && (needs_readable || length_ < high_watermark || length_ == 0);
+        }
+        
+        void onEofChunk() {
+            is_ended = true;
+            // emit 'readable' now to make sure it gets picked up.
+            emitReadable();
+        }
+        
+        // at this point, the user has presumably seen the 'readable' event,
+        // and called read() to consume some data.  that may have triggered
+        // in turn another _read(n) call, in which case reading = true if
+        // it's in progress.
+        // However, if we're not ended, or reading, and the length < hwm,
+        // then go ahead and try to read some more preemptively.
+        void maybeReadMore() {
+            if (is_reading_more)
+                return;
+            is_reading_more = true;
+            nextTick([this] {
+                size_type len = length_;
+                while (!is_reading && !is_flowing && !is_ended && length_ < high_watermark) {
+                    read(0);
+                    // didn't get any data, stop spinning.
+                    if (len == length_)
+                        break;
+                    len = length_;
+                }
+                is_reading_more = false;
+            });
         }
+        
         size_type howMuchToRead(size_type n) {
             if (length_ == 0 && is_ended)
                 return 0;
             if (object_mode)
                 return n == 0 ? 0 : 1;
+            if (n == 0)
+                return 0;
             
-            if (n > high_watermark)
-                high_watermark = ngn::utils::next_power_of_2(high_watermark+1);
+            // don't raise the hwm above UV_MAX_HWM
+            if (n > high_watermark && high_watermark < UV_MAX_HWM)
+                high_watermark = std::min<size_type>(ngn::utils::next_power_of_2(n), UV_MAX_HWM);
             
             if (n > length_) {
                 if (!is_ended) {
@@ -289,35 +728,47 @@ namespace ngn{
             return n;
         }
         void endReadable() {
-            assert(length_ > 0);
+            assert(length_ == 0);
             if (!is_end_emitted) {
                 is_ended = true;
-                /* next tick */
-                is_end_emitted = true;
-                is_readable = false;
-                onEnd();
+                // a read() in the meantime may have unshifted data back in
+                nextTick([this] {
+                    if (!is_end_emitted && length_ == 0) {
+                        is_end_emitted = true;
+                        is_readable = false;
+                        onEnd();
+                    }
+                });
             }
         }
         void emitReadable() {
             needs_readable = false;
             if (!is_readable_emitted) {
                 is_readable_emitted = true;
+                // don't emit from inside _read(), the caller isn't done yet
                 if (is_sync) {
-                    /* nextTick */
-                    emitReadableAndFlow();
+                    nextTick([this] { emitReadableAndFlow(); });
                 } else {
-                    emitReadable();
+                    emitReadableAndFlow();
                 }
             }
         }
         
         void emitReadableAndFlow() {
             onReadable();
+            flow();
+        }
+        void nextTick(small_task fn) {
+            isolate::instance().event_loop().nextTick(std::move(fn));
         }
+        // hands out one queued chunk at a time while flowing
         void flow() {
-            if (is_flowing) {
-                while (read());
-            }
+            while (is_flowing && read(flowSize()));
+        }
+        size_type flowSize() const {
+            if (object_mode)
+                return 1;
+            return buffer.empty() ? 0 : chunkLength(buffer.front());
         }
         // allocator
         allocator_type allocator;
@@ -326,8 +777,9 @@ namespace ngn{
         bool is_end_emitted = false;
         bool is_ended = false;
         bool is_reading = false;
+        bool is_resume_scheduled = false;
         size_t length_ = 0;
-        size_t high_watermark = traits_type::high_watermark;
+        size_t high_watermark;
         
         // a flag to be able to tell if the onwrite cb is called immediately,
         // or on a later tick.  We set this to true at first, because any
@@ -348,17 +800,373 @@ namespace ngn{
         
         // the number of writers that are awaiting a drain event in .pipe()s
         size_t awaiting_drain = 0;
+        // destinations of pipe(), with our listeners on the source's events
+        std::list<PipeTarget> pipes;
+        typename Event<const chunk_type&>::Connection pipe_data;
+        typename Event<>::Connection pipe_end;
+        typename Event<std::exception>::Connection pipe_error;
+        // > 0 while a loop walks pipes, removals are deferred until it's done
+        unsigned pipes_walking = 0;
+        bool is_piping = false;
         
         // if true, a maybeReadMore has been scheduled
         bool is_reading_more = false;
         
+        // queued chunks, reads take from the front
         buffer_type buffer;
 
         
     };
-    template <class ChunkType = Buffer, class Traits = stream_traits<ChunkType>, class Alloc = std::allocator<ChunkType>>
-    class WritableStreamBase {
+    
+    //
+    // Writable side of a stream, after node's stream.Writable
+    //
+    // Subclasses implement _write, and _writev when they can send several
+    // chunks at once. A chunk goes straight to _write when nothing is in
+    // flight, otherwise it queues up. write() returns false once the queue
+    // holds high_water_mark or more (bytes, or chunks in object mode): the
+    // producer should then wait for onDrain, which fires when the queue has
+    // emptied. Chunks written while corked, or while a write was in flight,
+    // go out together through a single _writev
+    //
+    template <class ChunkType, class Traits, class Alloc>
+    class WritableStream {
+    public:
+        typedef ChunkType chunk_type;
+        typedef Traits traits_type;
+        typedef size_t size_type;
+        typedef Alloc allocator_type;
+        typedef std::vector<chunk_type, allocator_type> chunk_list;
+        // status is 0 or a libuv error code
+        typedef inplace_function<void(int status)> write_callback;
+        
+        // constants
+        static const bool object_mode = traits_type::object_mode;
+        
+        // Events
+        Event<> onDrain;
+        Event<> onFinish;
+        Event<std::exception> onError;
+        
+        explicit WritableStream(size_type high_water_mark = traits_type::high_water_mark,
+                                allocator_type allocator = allocator_type()) :
+            allocator(allocator),
+            high_water_mark_(high_water_mark) {};
+        
+        // no copy constructor, in flight writes point back at us
+        WritableStream(const WritableStream&) = delete;
+        WritableStream& operator=(const WritableStream&) = delete;
+        
+        virtual ~WritableStream() = default;
+        
+        // false means the caller should hold off until onDrain
+        bool write(chunk_type chunk, write_callback cb = nullptr) {
+            ++pending_callbacks;
+            if (is_ended) {
+                onError(std::runtime_error("write after end"));
+                completed.push_back(Completion{std::move(cb), UV_EPIPE});
+                scheduleAfterWrite();
+                return false;
+            }
+            if (error_status < 0) {
+                onError(std::runtime_error("write after error"));
+                completed.push_back(Completion{std::move(cb), error_status});
+                scheduleAfterWrite();
+                return false;
+            }
+            
+            size_type len = chunkLength(chunk);
+            length_ += len;
+            bool ret = length_ < high_water_mark_;
+            // we must ensure that previous needDrain will not be reset to false.
+            if (!ret)
+                needs_drain = true;
+            
+            if (is_writing || corked)
+                buffer.push_back(WriteRequest{std::move(chunk), std::move(cb)});
+            else
+                doWrite(std::move(chunk), len, std::move(cb));
+            return ret;
+        }
+        
+        // no more writes, cb runs once everything has been written
+        void end(write_callback cb = nullptr) {
+            // uncork fully, whatever was corked still has to go out
+            if (corked) {
+                corked = 1;
+                uncork();
+            }
+            if (is_ending || is_finished)
+                return;
+            is_ending = true;
+            end_callback = std::move(cb);
+            finishMaybe();
+            is_ended = true;
+        }
+        void end(chunk_type chunk, write_callback cb = nullptr) {
+            write(std::move(chunk));
+            end(std::move(cb));
+        }
+        
+        // holds writes back until a matching uncork(), so they can be
+        // flushed with one _writev
+        void cork() {
+            ++corked;
+        }
+        void uncork() {
+            if (corked == 0)
+                return;
+            --corked;
+            if (!is_writing && !corked && !is_finished && !is_buffer_processing && !buffer.empty())
+                clearBuffer();
+        }
+        
+        size_type length() const {
+            return length_;
+        }
+        size_type high_water_mark() const {
+            return high_water_mark_;
+        }
+        bool is_corked() const {
+            return corked != 0;
+        }
+        bool needs_draining() const {
+            return needs_drain;
+        }
+        bool finished() const {
+            return is_finished;
+        }
+        
+        // descriptor the bytes end up in, or -1. a piped file source uses
+        // it to sendfile() straight into the socket
+        virtual uv_file _fileno() {
+            return -1;
+        }
+        
+    protected:
+        // writes one chunk, cb has to be called exactly once, sync or not
+        virtual void _write(chunk_type chunk, write_callback cb) = 0;
+        
+        // writes several chunks at once. by default they go through _write
+        // one after the other and cb runs after the last one
+        virtual void _writev(chunk_list chunks, write_callback cb) {
+            fallback.chunks = std::move(chunks);
+            fallback.index = 0;
+            fallback.status = 0;
+            fallback.done = std::move(cb);
+            writevNext();
+        }
+    private:
+        struct WriteRequest {
+            chunk_type chunk;
+            write_callback callback;
+        };
+        struct Completion {
+            write_callback callback;
+            int status;
+        };
+        
+        static size_type chunkLength(const chunk_type&, std::true_type) {
+            return 1;
+        }
+        static size_type chunkLength(const chunk_type& chunk, std::false_type) {
+            return chunk.size();
+        }
+        static size_type chunkLength(const chunk_type& chunk) {
+            return chunkLength(chunk, std::integral_constant<bool, object_mode>());
+        }
+        
+        void doWrite(chunk_type chunk, size_type len, write_callback cb) {
+            write_length = len;
+            write_callbacks.push_back(std::move(cb));
+            is_writing = true;
+            is_sync = true;
+            _write(std::move(chunk), [this](int status) { onWrite(status); });
+            is_sync = false;
+        }
+        
+        void doWritev() {
+            chunk_list chunks(allocator);
+            chunks.reserve(buffer.size());
+            size_type len = 0;
+            for (auto& req : buffer) {
+                len += chunkLength(req.chunk);
+                chunks.push_back(std::move(req.chunk));
+                write_callbacks.push_back(std::move(req.callback));
+            }
+            buffer.clear();
+            write_length = len;
+            is_writing = true;
+            is_sync = true;
+            _writev(std::move(chunks), [this](int status) { onWrite(status); });
+            is_sync = false;
+        }
+        
+        void onWrite(int status) {
+            is_writing = false;
+            length_ -= write_length;
+            write_length = 0;
+            for (auto& cb : write_callbacks)
+                completed.push_back(Completion{std::move(cb), status});
+            write_callbacks.clear();
+            
+            if (status < 0) {
+                // nothing queued behind a failed write goes out, like node's
+                // onwriteError the stream is done and they fail with it
+                error_status = status;
+                for (auto& req : buffer) {
+                    length_ -= chunkLength(req.chunk);
+                    completed.push_back(Completion{std::move(req.callback), status});
+                }
+                buffer.clear();
+                onError(std::runtime_error(uv_strerror(status)));
+            } else if (!corked && !is_buffer_processing && !buffer.empty()) {
+                clearBuffer();
+            }
+            
+            // callbacks never run from inside write()
+            if (is_sync)
+                scheduleAfterWrite();
+            else
+                afterWrite();
+        }
         
+        // if there's something in the buffer waiting, then process it
+        void clearBuffer() {
+            is_buffer_processing = true;
+            if (buffer.size() > 1) {
+                doWritev();
+            } else {
+                while (!buffer.empty()) {
+                    WriteRequest req = std::move(buffer.front());
+                    buffer.pop_front();
+                    size_type len = chunkLength(req.chunk);
+                    doWrite(std::move(req.chunk), len, std::move(req.callback));
+                    // the write went async, the rest goes when it's done
+                    if (is_writing)
+                        break;
+                }
+            }
+            is_buffer_processing = false;
+        }
+        
+        void scheduleAfterWrite() {
+            if (is_after_write_scheduled)
+                return;
+            is_after_write_scheduled = true;
+            nextTick([this] { afterWrite(); });
+        }
+        
+        void afterWrite() {
+            is_after_write_scheduled = false;
+            // must force callback to be called on nextTick, so that we don't
+            // emit 'drain' before the write() consumer gets the 'false' return
+            // value, and has a chance to attach a 'drain' listener.
+            if (length_ == 0 && needs_drain && !is_finished && error_status == 0) {
+                needs_drain = false;
+                onDrain();
+            }
+            // callbacks may write again, which appends to completed
+            std::vector<Completion> done;
+            done.swap(completed);
+            for (auto& c : done) {
+                --pending_callbacks;
+                if (c.callback)
+                    c.callback(c.status);
+            }
+            done.clear();
+            if (completed.empty())
+                completed.swap(done);
+            finishMaybe();
+        }
+        
+        void finishMaybe() {
+            if (!is_ending || is_finished || is_writing || length_ != 0 || !buffer.empty())
+                return;
+            if (pending_callbacks != 0 || is_after_write_scheduled)
+                return;
+            // a failed stream never finishes, end()'s callback gets the error
+            if (error_status < 0) {
+                if (end_callback) {
+                    write_callback cb = std::move(end_callback);
+                    cb(error_status);
+                }
+                return;
+            }
+            is_finished = true;
+            onFinish();
+            if (end_callback) {
+                write_callback cb = std::move(end_callback);
+                cb(0);
+            }
+        }
+        
+        // default _writev, loops instead of recursing when _write completes
+        // synchronously
+        void writevNext() {
+            while (fallback.status >= 0 && fallback.index < fallback.chunks.size()) {
+                fallback.looping = true;
+                fallback.completed_sync = false;
+                _write(std::move(fallback.chunks[fallback.index++]), [this](int status) {
+                    fallback.status = status;
+                    if (fallback.looping)
+                        fallback.completed_sync = true;
+                    else
+                        writevNext();
+                });
+                fallback.looping = false;
+                if (!fallback.completed_sync)
+                    return;
+            }
+            fallback.chunks.clear();
+            write_callback cb = std::move(fallback.done);
+            cb(fallback.status);
+        }
+        
+        void nextTick(small_task fn) {
+            isolate::instance().event_loop().nextTick(std::move(fn));
+        }
+        
+        // allocator
+        allocator_type allocator;
+        
+        size_type high_water_mark_;
+        // bytes (or objects) written but not yet acknowledged
+        size_type length_ = 0;
+        // size of the write that's in flight
+        size_type write_length = 0;
+        unsigned corked = 0;
+        // write() calls whose callback hasn't run yet
+        size_t pending_callbacks = 0;
+        // status of the write that failed, later writes fail with it too
+        int error_status = 0;
+        
+        bool is_writing = false;
+        // set while _write is on the stack, tells onWrite to defer
+        bool is_sync = false;
+        bool is_buffer_processing = false;
+        bool is_after_write_scheduled = false;
+        bool needs_drain = false;
+        bool is_ending = false;
+        bool is_ended = false;
+        bool is_finished = false;
+        
+        std::deque<WriteRequest> buffer;
+        // callbacks of the write in flight, one per chunk
+        std::vector<write_callback> write_callbacks;
+        // finished writes waiting for afterWrite
+        std::vector<Completion> completed;
+        write_callback end_callback;
+        
+        // state of the default _writev
+        struct {
+            chunk_list chunks;
+            size_t index = 0;
+            int status = 0;
+            bool looping = false;
+            bool completed_sync = false;
+            write_callback done;
+        } fallback;
     };
     /*
     template<class ChunkType, class Traits = stream_traits<ChunkType>>
@@ -539,52 +1347,6 @@ namespace ngn{
         buffer_type buffer_;
     };
     
-    template<class WriteType, class Traits = stream_traits<WriteType>>
-    class WritableStream{
-    public:
-        typedef typename Traits::buffer_type buffer_type;
-        typedef WriteType write_type;
-        //typedef typename data_event_traits<buffer_type, write_type, Traits::object_mode>::event_type data_pipe_type;
-        static constexpr bool object_mode = Traits::object_mode;
-        
-        typedef std::function<void()> writeCallback;
-        Event<> onDrain;
-        Event<> onFinish;
-        //Event<ReadableStream<data_pipe_type>> onPipe;
-       // Event<ReadableStream<data_pipe_type>> onUnpipe;
-        Event<std::exception> onError;
-        
-        WritableStream(const EventLoop& loop = EventLoop::default_loop()) : event_loop_(loop){
-            
-        }
-        
-        template <class ChunkType>
-        bool write(ChunkType chunk, writeCallback cb);
-        template <class ChunkType>
-        bool end(ChunkType chunk, writeCallback cb);
-        
-        void cork();
-        void uncork();
-        void reserve(size_t size);
-        
-        virtual ~WritableStream() = default;
-        
-        
-    private:
-        struct WriteRequest_{
-            WriteType chunk;
-            writeCallback callback;
-        };
-        bool sync_;
-        bool is_writing_;
-        bool is_finished_;
-        bool is_buffer_processing_;
-        bool need_drain_;
-        int pending_callbacks_;
-        const EventLoop& event_loop_;
-        size_t length;
-        std::vector<WriteRequest_> buffer_;
-    };
     */
     
 }
@@ -20,11 +20,14 @@
 // USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "string_bytes.h"
+#include "ascii.h"
+#include "utf8.h"
 
 #include <assert.h>
 #include <limits.h>
 #include <string.h>  // memcpy
 #include <codecvt>
+#include <vector>
 
 // When creating strings >= this length v8's gc spins up and consumes
 // most of the execution time. For these cases it's more performant to
@@ -35,150 +38,6 @@ namespace ngn {
     
     
     
-    //// Base 64 ////
-    
-#define base64_encoded_size(size) ((size + 2 - ((size + 2) % 3)) / 3 * 4)
-    
-    
-    // Doesn't check for padding at the end.  Can be 1-2 bytes over.
-    static inline size_t base64_decoded_size_fast(size_t size) {
-        size_t remainder = size % 4;
-        
-        size = (size / 4) * 3;
-        if (remainder) {
-            if (size == 0 && remainder == 1) {
-                // special case: 1-byte input cannot be decoded
-                size = 0;
-            } else {
-                // non-padded input, add 1 or 2 extra bytes
-                size += 1 + (remainder == 3);
-            }
-        }
-        
-        return size;
-    }
-    
-    template <typename TypeName>
-    size_t base64_decoded_size(const TypeName* src, size_t size) {
-        if (size == 0)
-            return 0;
-        
-        if (src[size - 1] == '=')
-            size--;
-        if (size > 0 && src[size - 1] == '=')
-            size--;
-        
-        return base64_decoded_size_fast(size);
-    }
-    
-    
-    // supports regular and URL-safe base64
-    static const int unbase64_table[] =
-    { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -2, -1, -1, -2, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, 62, -1, 63,
-        52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
-        -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
-        15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
-        -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
-        41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
-    };
-#define unbase64(x) unbase64_table[(uint8_t)(x)]
-    
-    
-    template <typename TypeName>
-    size_t base64_decode(char* buf,
-                         size_t len,
-                         const TypeName* src,
-                         const size_t srcLen) {
-        char a, b, c, d;
-        char* dst = buf;
-        char* dstEnd = buf + len;
-        const TypeName* srcEnd = src + srcLen;
-        
-        while (src < srcEnd && dst < dstEnd) {
-            size_t remaining = srcEnd - src;
-            
-            while (unbase64(*src) < 0 && src < srcEnd)
-                src++, remaining--;
-            if (remaining == 0 || *src == '=')
-                break;
-            a = unbase64(*src++);
-            
-            while (unbase64(*src) < 0 && src < srcEnd)
-                src++, remaining--;
-            if (remaining <= 1 || *src == '=')
-                break;
-            b = unbase64(*src++);
-            
-            *dst++ = (a << 2) | ((b & 0x30) >> 4);
-            if (dst == dstEnd)
-                break;
-            
-            while (unbase64(*src) < 0 && src < srcEnd)
-                src++, remaining--;
-            if (remaining <= 2 || *src == '=')
-                break;
-            c = unbase64(*src++);
-            
-            *dst++ = ((b & 0x0F) << 4) | ((c & 0x3C) >> 2);
-            if (dst == dstEnd)
-                break;
-            
-            while (unbase64(*src) < 0 && src < srcEnd)
-                src++, remaining--;
-            if (remaining <= 3 || *src == '=')
-                break;
-            d = unbase64(*src++);
-            
-            *dst++ = ((c & 0x03) << 6) | (d & 0x3F);
-        }
-        
-        return dst - buf;
-    }
-    
-    
-    //// HEX ////
-    
-    template <typename TypeName>
-    unsigned hex2bin(TypeName c) {
-        if (c >= '0' && c <= '9')
-            return c - '0';
-        if (c >= 'A' && c <= 'F')
-            return 10 + (c - 'A');
-        if (c >= 'a' && c <= 'f')
-            return 10 + (c - 'a');
-        return static_cast<unsigned>(-1);
-    }
-    
-    
-    template <typename TypeName>
-    size_t hex_decode(char* buf,
-                      size_t len,
-                      const TypeName* src,
-                      const size_t srcLen) {
-        size_t i;
-        for (i = 0; i < len && i * 2 + 1 < srcLen; ++i) {
-            unsigned a = hex2bin(src[i * 2 + 0]);
-            unsigned b = hex2bin(src[i * 2 + 1]);
-            if (!~a || !~b)
-                return i;
-            buf[i] = a * 16 + b;
-        }
-        
-        return i;
-    }
-    
-    
-    
     size_t StringBytes::Write(char* buf,
                               size_t buflen,
                               const Buffer& val,
@@ -198,16 +57,31 @@ namespace ngn {
                 break;
                 
             case UTF8:
-                // add utf encoding
+                // the string is already utf8, just don't cut a character in half
+                if (len < val.size()) {
+                    while (len > 0 && (data[len] & 0xC0) == 0x80)
+                        len--;
+                }
                 memcpy(buf, data, len);
+                if (chars_written != nullptr)
+                    *chars_written = utf16_length_from_utf8(data, len);
+                break;
                 
-            case UCS2:
-                // add ucs2 encoding
-                memcpy(buf, data, len * 2);
-                if (chars_written != NULL)
-                    *chars_written = len;
-                len = len * sizeof(uint16_t);
+            case UCS2: {
+                const size_t max_units = buflen / sizeof(char16_t);
+                size_t units;
+                if (reinterpret_cast<uintptr_t>(buf) % alignof(char16_t) == 0) {
+                    units = utf8_to_utf16(data, val.size(), reinterpret_cast<char16_t*>(buf), max_units);
+                } else {
+                    std::vector<char16_t> aligned(max_units);
+                    units = utf8_to_utf16(data, val.size(), aligned.data(), max_units);
+                    memcpy(buf, aligned.data(), units * sizeof(char16_t));
+                }
+                if (chars_written != nullptr)
+                    *chars_written = units;
+                len = units * sizeof(char16_t);
                 break;
+            }
                 
             case BASE64:
                 base64_decode(buf, buflen, data, len);
@@ -242,15 +116,23 @@ namespace ngn {
     
     // Quick and dirty size calculation
     // Will always be at least big enough, but may have some extra
-    // UTF8 can be as much as 3x the size, Base64 can have 1-2 extra bytes
+    // UCS2 can be as much as 2x the size, Base64 can have 1-2 extra bytes
     size_t StringBytes::StorageSize(const std::string& str, enum encoding encoding) {
         size_t data_size = 0;
         
         switch (encoding) {
             case ASCII:
+            case BINARY:
+            case BUFFER:
+            case UTF8:
                 data_size = str.length();
                 break;
                 
+            case UCS2:
+                // at most one utf16 unit per byte
+                data_size = str.length() * sizeof(char16_t);
+                break;
+                
             case BASE64:
                 data_size = base64_decoded_size_fast(str.length());
                 break;
@@ -274,9 +156,16 @@ namespace ngn {
         
         switch (encoding) {
             case ASCII:
+            case BINARY:
+            case BUFFER:
+            case UTF8:
                 data_size = str.length();
                 break;
                 
+            case UCS2:
+                data_size = utf16_length_from_utf8(str.data(), str.length()) * sizeof(char16_t);
+                break;
+                
             case BASE64: {
                 data_size = base64_decoded_size(&str[0], str.length());
                 break;
@@ -297,191 +186,6 @@ namespace ngn {
     
     
     
-    static bool contains_non_ascii_slow(const char* buf, size_t len) {
-        for (size_t i = 0; i < len; ++i) {
-            if (buf[i] & 0x80)
-                return true;
-        }
-        return false;
-    }
-    
-    
-    static bool contains_non_ascii(const char* src, size_t len) {
-        if (len < 16) {
-            return contains_non_ascii_slow(src, len);
-        }
-        
-        const unsigned bytes_per_word = sizeof(uintptr_t);
-        const unsigned align_mask = bytes_per_word - 1;
-        const unsigned unaligned = reinterpret_cast<uintptr_t>(src) & align_mask;
-        
-        if (unaligned > 0) {
-            const unsigned n = bytes_per_word - unaligned;
-            if (contains_non_ascii_slow(src, n))
-                return true;
-            src += n;
-            len -= n;
-        }
-        
-        
-#if defined(__x86_64__) || defined(_WIN64)
-        const uintptr_t mask = 0x8080808080808080ll;
-#else
-        const uintptr_t mask = 0x80808080l;
-#endif
-        
-        const uintptr_t* srcw = reinterpret_cast<const uintptr_t*>(src);
-        
-        for (size_t i = 0, n = len / bytes_per_word; i < n; ++i) {
-            if (srcw[i] & mask)
-                return true;
-        }
-        
-        const unsigned remainder = len & align_mask;
-        if (remainder > 0) {
-            const size_t offset = len - remainder;
-            if (contains_non_ascii_slow(src + offset, remainder))
-                return true;
-        }
-        
-        return false;
-    }
-    
-    
-    static void force_ascii_slow(const char* src, char* dst, size_t len) {
-        for (size_t i = 0; i < len; ++i) {
-            dst[i] = src[i] & 0x7f;
-        }
-    }
-    
-    
-    static void force_ascii(const char* src, char* dst, size_t len) {
-        if (len < 16) {
-            force_ascii_slow(src, dst, len);
-            return;
-        }
-        
-        const unsigned bytes_per_word = sizeof(uintptr_t);
-        const unsigned align_mask = bytes_per_word - 1;
-        const unsigned src_unalign = reinterpret_cast<uintptr_t>(src) & align_mask;
-        const unsigned dst_unalign = reinterpret_cast<uintptr_t>(dst) & align_mask;
-        
-        if (src_unalign > 0) {
-            if (src_unalign == dst_unalign) {
-                const unsigned unalign = bytes_per_word - src_unalign;
-                force_ascii_slow(src, dst, unalign);
-                src += unalign;
-                dst += unalign;
-                len -= src_unalign;
-            } else {
-                force_ascii_slow(src, dst, len);
-                return;
-            }
-        }
-        
-#if defined(__x86_64__) || defined(_WIN64)
-        const uintptr_t mask = ~0x8080808080808080ll;
-#else
-        const uintptr_t mask = ~0x80808080l;
-#endif
-        
-        const uintptr_t* srcw = reinterpret_cast<const uintptr_t*>(src);
-        uintptr_t* dstw = reinterpret_cast<uintptr_t*>(dst);
-        
-        for (size_t i = 0, n = len / bytes_per_word; i < n; ++i) {
-            dstw[i] = srcw[i] & mask;
-        }
-        
-        const unsigned remainder = len & align_mask;
-        if (remainder > 0) {
-            const size_t offset = len - remainder;
-            force_ascii_slow(src + offset, dst + offset, remainder);
-        }
-    }
-    
-    
-    static size_t base64_encode(const char* src,
-                                size_t slen,
-                                char* dst,
-                                size_t dlen) {
-        // We know how much we'll write, just make sure that there's space.
-        assert(dlen >= base64_encoded_size(slen) &&
-               "not enough space provided for base64 encode");
-        
-        dlen = base64_encoded_size(slen);
-        
-        unsigned a;
-        unsigned b;
-        unsigned c;
-        unsigned i;
-        unsigned k;
-        unsigned n;
-        
-        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz"
-        "0123456789+/";
-        
-        i = 0;
-        k = 0;
-        n = slen / 3 * 3;
-        
-        while (i < n) {
-            a = src[i + 0] & 0xff;
-            b = src[i + 1] & 0xff;
-            c = src[i + 2] & 0xff;
-            
-            dst[k + 0] = table[a >> 2];
-            dst[k + 1] = table[((a & 3) << 4) | (b >> 4)];
-            dst[k + 2] = table[((b & 0x0f) << 2) | (c >> 6)];
-            dst[k + 3] = table[c & 0x3f];
-            
-            i += 3;
-            k += 4;
-        }
-        
-        if (n != slen) {
-            switch (slen - n) {
-                case 1:
-                    a = src[i + 0] & 0xff;
-                    dst[k + 0] = table[a >> 2];
-                    dst[k + 1] = table[(a & 3) << 4];
-                    dst[k + 2] = '=';
-                    dst[k + 3] = '=';
-                    break;
-                    
-                case 2:
-                    a = src[i + 0] & 0xff;
-                    b = src[i + 1] & 0xff;
-                    dst[k + 0] = table[a >> 2];
-                    dst[k + 1] = table[((a & 3) << 4) | (b >> 4)];
-                    dst[k + 2] = table[(b & 0x0f) << 2];
-                    dst[k + 3] = '=';
-                    break;
-            }
-        }
-        
-        return dlen;
-    }
-    
-    
-    static size_t hex_encode(const char* src, size_t slen, char* dst, size_t dlen) {
-        // We know how much we'll write, just make sure that there's space.
-        assert(dlen >= slen * 2 &&
-               "not enough space provided for hex encode");
-        
-        dlen = slen * 2;
-        for (uint32_t i = 0, k = 0; k < dlen; i += 1, k += 2) {
-            static const char hex[] = "0123456789abcdef";
-            uint8_t val = static_cast<uint8_t>(src[i]);
-            dst[k + 0] = hex[val >> 4];
-            dst[k + 1] = hex[val & 15];
-        }
-        
-        return dlen;
-    }
-    
-    
-    
     Buffer StringBytes::Encode(const char* buf,
                                      size_t buflen,
                                      enum encoding encoding) {
@@ -496,10 +200,20 @@ namespace ngn {
                 }
                 break;
                 
-            case UTF8:
-                assert(0 && "utf8 encoding not yet supported");
-                return Buffer{Buffer::size_type(0)};
+            case UTF8: {
+                if (utf8_validate(buf, buflen))
+                    return Buffer(buf, buflen);
+                
+                // replace malformed sequences with U+FFFD
+                std::vector<char16_t> units(utf16_length_from_utf8(buf, buflen));
+                utf8_to_utf16(buf, buflen, units.data(), units.size());
+                size_t dlen = utf8_length_from_utf16(units.data(), units.size());
+                Buffer val(dlen);
+                size_t written = utf16_to_utf8(units.data(), units.size(), reinterpret_cast<char*>(&val[0]), dlen);
+                assert(written == dlen);
+                return val;
                 break;
+            }
                 
             case BASE64: {
                 size_t dlen = base64_encoded_size(buflen);
@@ -511,8 +225,20 @@ namespace ngn {
             }
                 
             case UCS2: {
-                assert(0 && "UCS2 encoding not yet supported");
-                return Buffer(0ul);
+                // little endian utf16, an odd trailing byte is dropped
+                const char16_t* units = reinterpret_cast<const char16_t*>(buf);
+                const size_t count = buflen / sizeof(char16_t);
+                std::vector<char16_t> aligned;
+                if (reinterpret_cast<uintptr_t>(buf) % alignof(char16_t) != 0) {
+                    aligned.resize(count);
+                    memcpy(aligned.data(), buf, count * sizeof(char16_t));
+                    units = aligned.data();
+                }
+                size_t dlen = utf8_length_from_utf16(units, count);
+                Buffer val(dlen);
+                size_t written = utf16_to_utf8(units, count, reinterpret_cast<char*>(&val[0]), dlen);
+                assert(written == dlen);
+                return val;
                 break;
             }
                 
@@ -532,6 +258,49 @@ namespace ngn {
         return Buffer(0ul);
         
     }
+    
+    
+    Buffer Base64Decoder::write(const Buffer& chunk) {
+        if (chunk.size() == 0)
+            return Buffer(0ul);
+        
+        const char* src = &*chunk.cbegin();
+        const char* src_end = src + chunk.size();
+        Buffer val(m_decoder.max_decoded_size(chunk.size()));
+        char* dst = &val[0];
+        size_t written = m_decoder.decode(src, src_end, dst, dst + val.size());
+        assert(src == src_end);
+        return val.slice(val.begin(), val.begin() + written);
+    }
+    
+    
+    Buffer Base64Decoder::end() {
+        char tail[2];
+        size_t written = m_decoder.finish(tail, tail + sizeof(tail));
+        return Buffer(tail, written);
+    }
+    
+    
+    Buffer Base64Encoder::write(const Buffer& chunk) {
+        if (chunk.size() == 0)
+            return Buffer(0ul);
+        
+        const char* src = &*chunk.cbegin();
+        const char* src_end = src + chunk.size();
+        // room for the pending bytes completing a group plus the chunk itself
+        Buffer val(base64_encoded_size(chunk.size() + 2));
+        char* dst = &val[0];
+        size_t written = m_encoder.encode(src, src_end, dst, dst + val.size());
+        assert(src == src_end);
+        return val.slice(val.begin(), val.begin() + written);
+    }
+    
+    
+    Buffer Base64Encoder::end() {
+        char tail[4];
+        size_t written = m_encoder.finish(tail, tail + sizeof(tail));
+        return Buffer(tail, written);
+    }
 
     
 }  // namespace node
\ No newline at end of file
@@ -28,6 +28,8 @@
 #include <iostream>
 #include "ngn.h"
 #include "buffer.h"
+#include "base64.h"
+#include "hex.h"
 // Decodes a v8::Handle<v8::String> or Buffer to a raw char*
 namespace std {
     template <>
@@ -35,51 +37,6 @@ namespace std {
         
     };
 }
-template <typename TypeName>
-unsigned hex2bin(TypeName c) {
-    if (c >= '0' && c <= '9')
-        return c - '0';
-    if (c >= 'A' && c <= 'F')
-        return 10 + (c - 'A');
-    if (c >= 'a' && c <= 'f')
-        return 10 + (c - 'a');
-    return static_cast<unsigned>(-1);
-}
-//// Base 64 ////
-
-#define base64_encoded_size(size) ((size + 2 - ((size + 2) % 3)) / 3 * 4)
-
-
-// Doesn't check for padding at the end.  Can be 1-2 bytes over.
-static inline size_t base64_decoded_size_fast(size_t size) {
-    size_t remainder = size % 4;
-    
-    size = (size / 4) * 3;
-    if (remainder) {
-        if (size == 0 && remainder == 1) {
-            // special case: 1-byte input cannot be decoded
-            size = 0;
-        } else {
-            // non-padded input, add 1 or 2 extra bytes
-            size += 1 + (remainder == 3);
-        }
-    }
-    
-    return size;
-};
-
-template <typename TypeName>
-size_t base64_decoded_size(const TypeName* src, size_t size) {
-    if (size == 0)
-        return 0;
-    
-    if (src[size - 1] == '=')
-        size--;
-    if (size > 0 && src[size - 1] == '=')
-        size--;
-    
-    return base64_decoded_size_fast(size);
-};
 
 namespace ngn {
     class StringBytes {
@@ -90,11 +47,10 @@ namespace ngn {
         static bool IsValidString(std::string string, enum encoding enc);
         
         // Fast, but can be 2 bytes oversized for Base64, and
-        // as much as triple UTF-8 strings <= 65536 chars in length
+        // as much as double for UCS2
         static size_t StorageSize(const std::string& val, enum encoding enc);
         
-        // Precise byte count, but slightly slower for Base64 and
-        // very much slower for UTF-8
+        // Precise byte count, but slightly slower for Base64 and UCS2
         static size_t Size(const std::string& val, enum encoding enc);
         
         
@@ -126,12 +82,11 @@ namespace ngn {
             return std::min<int>(max, base64_encoded_size(to_end - to));
         };
     protected:
+        // zeroed state is a fresh encoder/decoder
         union state_impl_t {
             state_type state;
-            struct p_impl{
-                char last_chars[3];
-                unsigned count = 0;
-            } impl;
+            base64_encoder encoder;
+            base64_decoder decoder;
         };
        
         static_assert(sizeof(state_impl_t) == sizeof(state_type),
@@ -145,65 +100,9 @@ namespace ngn {
                       extern_type* to_end,
                       extern_type*& to_next ) const {
             from_next = from;
-            to_next = to;
-            static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-            "abcdefghijklmnopqrstuvwxyz"
-            "0123456789+/";
-            state_impl_t::p_impl* m_state = &(reinterpret_cast<state_impl_t&>(state)).impl;
-            const bool has_state = m_state->count > 0;
-            
-            unsigned a;
-            unsigned b;
-            unsigned c;
-     
-            if (has_state) {
-                while (from_next < from_end && m_state->count <= 3) {
-                    m_state->last_chars[(m_state->count++)] = *(from_next++) & 0xff;
-                }
-                assert(m_state->count >= 0 && m_state->count <= 3);
-                if (m_state->count <= 3) {
-                    // didn't fill the buffer yet
-                    return partial;
-                } else {
-                    if (to_next + 3 < to_end) {
-                        a = m_state->last_chars[0];
-                        b = m_state->last_chars[1];
-                        c = m_state->last_chars[2];
-                        
-                        *(to_next++) = table[a >> 2];
-                        *(to_next++) = table[((a & 3) << 4) | (b >> 4)];
-                        *(to_next++) = table[((b & 0x0f) << 2) | (c >> 6)];
-                        *(to_next++) = table[c & 0x3f];
-                        
-                        // reset state
-                        m_state->count = 0;
-                    } else {
-                        // not enough space in the destination buffer
-                        return partial;
-                    }
-                }
-            }
-            
-            while (from_next + 2 < from_end && to_next + 3 < to_end) {
-                a = *(from_next++) & 0xff;
-                b = *(from_next++) & 0xff;
-                c = *(from_next++) & 0xff;
-                
-                *(to_next++) = table[a >> 2];
-                *(to_next++) = table[((a & 3) << 4) | (b >> 4)];
-                *(to_next++) = table[((b & 0x0f) << 2) | (c >> 6)];
-                *(to_next++) = table[c & 0x3f];
-            }
-            // get leftover chunks
-            auto delta = from_end - from_next;
-            if (delta <= 3 - m_state->count) {
-                while (from_next < from_end && m_state) {
-                    m_state->last_chars[(m_state->count++)] = *(from_next++);
-                }
-            }
-            
+            base64_encoder& encoder = reinterpret_cast<state_impl_t&>(state).encoder;
+            to_next = to + encoder.encode(from_next, from_end, to, to_end);
             return from_next == from_end ? ok : partial;
-
         };
         // base64 -> bytes
         result do_in( state_type& state,
@@ -214,8 +113,9 @@ namespace ngn {
                      intern_type* to_end,
                      intern_type*& to_next ) const {
             from_next = from;
-            to_next = to;
-            
+            base64_decoder& decoder = reinterpret_cast<state_impl_t&>(state).decoder;
+            to_next = to + decoder.decode(from_next, from_end, to, to_end);
+            return from_next == from_end ? ok : partial;
         };
         int do_length( state_type& state,
                       const extern_type* from,
@@ -224,7 +124,7 @@ namespace ngn {
             return std::min<int>(max, base64_decoded_size(from, from_end - from));
         };
         int do_max_length() const noexcept {
-            return 3;
+            return 4;
         };
         
         int do_encoding() const noexcept {
@@ -234,50 +134,40 @@ namespace ngn {
         bool do_always_noconv() const noexcept {
             return false;
         };
+        // writes the padded final group
         result do_unshift(state_type& state,
                           extern_type* to,
                           extern_type* to_end,
                           extern_type*& to_next) const {
-            state_impl_t::p_impl* m_state = &(reinterpret_cast<state_impl_t&>(state)).impl;
-            if (m_state->count == 0) return ok;
-
-            unsigned a = m_state->last_chars[0];
-            unsigned b = m_state->last_chars[1];
-            unsigned c = m_state->last_chars[2];
-            
-            static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-            "abcdefghijklmnopqrstuvwxyz"
-            "0123456789+/";
+            base64_encoder& encoder = reinterpret_cast<state_impl_t&>(state).encoder;
             to_next = to;
-            if (to_next + 3 < to_end) {
-                switch (m_state->count) {
-                    case 1:
-                        *(to_next++) = table[a >> 2];
-                        *(to_next++) = table[(a & 3) << 4];
-                        *(to_next++) = '=';
-                        *(to_next++) = '=';
-                        break;
-                    case 2:
-                        *(to_next++) = table[a >> 2];
-                        *(to_next++) = table[((a & 3) << 4) | (b >> 4)];
-                        *(to_next++) = table[(b & 0x0f) << 2];
-                        *(to_next++) = '=';
-                        break;
-                    case 3:
-                        *(to_next++) = table[a >> 2];
-                        *(to_next++) = table[((a & 3) << 4) | (b >> 4)];
-                        *(to_next++) = table[((b & 0x0f) << 2) | (c >> 6)];
-                        *(to_next++) = table[c & 0x3f];
-                        break;
-                }
-                m_state->count = 0;
-            } else {
-                return partial;
-            }
-            return ok;
+            to_next += encoder.finish(to, to_end);
+            return encoder.has_pending() ? partial : ok;
         };
         
     };
+    
+    // Decodes base64 one chunk at a time, eg. from the onData event of a
+    // ReadableStream<Buffer>. Only an unfinished group is held between chunks
+    // so memory stays bounded by the chunk size.
+    class Base64Decoder {
+    public:
+        Buffer write(const Buffer& chunk);
+        // decodes whatever is left of unpadded input
+        Buffer end();
+    private:
+        base64_decoder m_decoder;
+    };
+    
+    class Base64Encoder {
+    public:
+        explicit Base64Encoder(bool url_safe = false) : m_encoder(url_safe) {}
+        Buffer write(const Buffer& chunk);
+        // writes the padded final group
+        Buffer end();
+    private:
+        base64_encoder m_encoder;
+    };
 
     class codecvt_hex
     : public std::codecvt<char, char, std::mbstate_t> {
@@ -304,12 +194,9 @@ namespace ngn {
                       extern_type*& to_next ) const {
             from_next = from;
             to_next = to;
-            while (from_next != from_end && to_next + 1 < to_end) {
-                static const char hex[] = "0123456789abcdef";
-                uint8_t val = static_cast<uint8_t>(*(from_next++));
-                *(to_next++) = hex[val >> 4];
-                *(to_next++) = hex[val & 15];
-            }
+            const size_t count = std::min<size_t>(from_end - from_next, (to_end - to_next) / 2);
+            to_next += hex_encode(from_next, count, to_next, count * 2);
+            from_next += count;
             return from_next != from_end ? result:: partial : result::ok;
         };
         // hex -> bytes
@@ -335,17 +222,16 @@ namespace ngn {
                     memset(&state, 0, sizeof(state_type));
                 }
             }
-            while (from_next + 1 < from_end && to_next != to_end) {
-                unsigned a = hex2bin(*(from_next++));
-                unsigned b = hex2bin(*(from_next++));
-                auto i = (!~a) + (!~b);
-                if (i > 0) {
-                    from_next -= i;
-                    // invalid hex
-                    return error;
-                }
-                *(to_next++) = a * 16 + b;
+            const size_t count = std::min<size_t>((from_end - from_next) / 2, to_end - to_next);
+            size_t invalid;
+            const size_t written = hex_decode(to_next, count, from_next, count * 2, &invalid);
+            to_next += written;
+            if (written < count) {
+                // invalid hex, point at the offending digit
+                from_next += invalid;
+                return error;
             }
+            from_next += count * 2;
             if (std::distance(from_next, from_end) == 1) {
                 reinterpret_cast<state_impl_t&>(state).last_char = *(from_next++);
                 return partial;
@@ -0,0 +1,309 @@
+//
+//  timer_wheel.cpp
+//  ngn
+//
+//
+//
+
+#include "timer_wheel.h"
+#include <cassert>
+
+namespace ngn {
+    //
+    // Hook
+    //
+
+    timer_wheel::hook::hook(timer_wheel& wheel) noexcept :
+        m_wheel(&wheel),
+        m_expiry(0),
+        m_interval(0),
+        m_level(detached),
+        m_slot(0),
+        m_ref(true),
+        m_owned(false) {
+        prev = nullptr;
+        next = nullptr;
+    };
+
+    timer_wheel::hook::~hook() {
+        if (m_wheel == nullptr)
+            return;
+        if (is_linked()) {
+            m_wheel->unlink(*this);
+            if (!m_wheel->m_advancing) {
+                m_wheel->arm();
+                m_wheel->update_ref();
+            }
+        }
+        if (m_wheel->m_running == this)
+            m_wheel->m_running = nullptr;
+    };
+
+    //
+    // Wheel
+    //
+
+    void timer_wheel::on_timer(uv_timer_t* handle, int status) {
+        auto wheel = static_cast<timer_wheel*>(handle->data);
+        wheel->m_armed = false;
+        wheel->advance(wheel->now());
+        wheel->arm();
+        wheel->update_ref();
+    };
+
+    timer_wheel::timer_wheel(uv_loop_t* loop) :
+        m_loop(loop),
+        m_elapsed(uv_now(loop)),
+        m_count(0),
+        m_refs(0),
+        m_running(nullptr),
+        m_armed_deadline(0),
+        m_armed(false),
+        m_advancing(false),
+        m_handle_ref(true) {
+        for (unsigned level = 0; level < level_count; ++level) {
+            m_occupied[level] = 0;
+            for (unsigned slot = 0; slot < slot_count; ++slot)
+                m_slots[level][slot].prev = m_slots[level][slot].next = &m_slots[level][slot];
+        }
+        uv_timer_init(loop, &m_handle);
+        m_handle.data = this;
+    };
+
+    timer_wheel::~timer_wheel() {
+        // timers that are still armed forget about us, owned ones go
+        for (unsigned level = 0; level < level_count; ++level) {
+            for (unsigned slot = 0; slot < slot_count; ++slot) {
+                link& head = m_slots[level][slot];
+                while (head.next != &head) {
+                    hook& h = static_cast<hook&>(*head.next);
+                    unlink(h);
+                    if (h.m_owned)
+                        delete &h;
+                    else
+                        h.m_wheel = nullptr;
+                }
+            }
+        }
+    };
+
+    void timer_wheel::close() {
+        uv_close(reinterpret_cast<uv_handle_t*>(&m_handle), nullptr);
+    };
+
+    //
+    // Scheduling
+    //
+
+    void timer_wheel::schedule(hook& h, uint64_t timeout, uint64_t interval) {
+        assert(h.m_wheel == this);
+        if (h.is_linked())
+            unlink(h);
+        else if (m_count == 0 && !m_advancing)
+            // nothing armed, skip the idle stretch instead of cascading
+            // through it later
+            m_elapsed = now();
+        h.m_interval = interval;
+        insert(h, now() + timeout);
+        if (!m_advancing) {
+            arm();
+            update_ref();
+        }
+    };
+
+    void timer_wheel::cancel(hook& h) {
+        if (h.is_linked())
+            unlink(h);
+        if (!m_advancing) {
+            arm();
+            update_ref();
+        }
+        // a running timer is freed by expire() once its callback returns
+        if (h.m_owned && m_running != &h)
+            delete &h;
+    };
+
+    void timer_wheel::ref(hook& h) {
+        if (h.m_ref)
+            return;
+        h.m_ref = true;
+        if (h.is_linked()) {
+            ++m_refs;
+            update_ref();
+        }
+    };
+
+    void timer_wheel::unref(hook& h) {
+        if (!h.m_ref)
+            return;
+        h.m_ref = false;
+        if (h.is_linked()) {
+            --m_refs;
+            update_ref();
+        }
+    };
+
+    //
+    // Slots
+    //
+
+    void timer_wheel::insert(hook& h, uint64_t expiry) {
+        // due timers fire on the next pass, never in the one that's running
+        if (expiry <= m_elapsed)
+            expiry = m_elapsed + 1;
+        h.m_expiry = expiry;
+
+        // the highest bit where expiry and the wheel's time differ picks
+        // the level, everything below it the slot
+        unsigned level, slot;
+        uint64_t masked = (m_elapsed ^ expiry) | (slot_count - 1);
+        if (masked >= max_range) {
+            level = level_count - 1;
+            slot = ((m_elapsed >> (slot_bits * level)) + slot_count - 1) & (slot_count - 1);
+        } else {
+            level = (63 - __builtin_clzll(masked)) / slot_bits;
+            slot = (expiry >> (slot_bits * level)) & (slot_count - 1);
+        }
+
+        link& head = m_slots[level][slot];
+        h.prev = head.prev;
+        h.next = &head;
+        head.prev->next = &h;
+        head.prev = &h;
+        h.m_level = static_cast<unsigned char>(level);
+        h.m_slot = static_cast<unsigned char>(slot);
+        m_occupied[level] |= uint64_t(1) << slot;
+
+        ++m_count;
+        if (h.m_ref)
+            ++m_refs;
+    };
+
+    void timer_wheel::unlink(hook& h) {
+        h.prev->next = h.next;
+        h.next->prev = h.prev;
+        if (h.m_level != detached) {
+            link& head = m_slots[h.m_level][h.m_slot];
+            if (head.next == &head)
+                m_occupied[h.m_level] &= ~(uint64_t(1) << h.m_slot);
+        }
+        h.prev = nullptr;
+        h.next = nullptr;
+        h.m_level = detached;
+
+        --m_count;
+        if (h.m_ref)
+            --m_refs;
+    };
+
+    bool timer_wheel::next_expiration(unsigned& level, unsigned& slot, uint64_t& deadline) const {
+        // anything filed at a level starts after everything filed below it
+        for (unsigned i = 0; i < level_count; ++i) {
+            uint64_t occupied = m_occupied[i];
+            if (occupied == 0)
+                continue;
+            unsigned shift = slot_bits * i;
+            unsigned current = (m_elapsed >> shift) & (slot_count - 1);
+            uint64_t rotated = current ? (occupied >> current) | (occupied << (64 - current)) : occupied;
+            unsigned next = (current + __builtin_ctzll(rotated)) & (slot_count - 1);
+
+            uint64_t slot_range = uint64_t(1) << shift;
+            uint64_t level_range = slot_range << slot_bits;
+            deadline = (m_elapsed & ~(level_range - 1)) + next * slot_range;
+            // only timers parked past the top level wrap around
+            if (next < current)
+                deadline += level_range;
+            level = i;
+            slot = next;
+            return true;
+        }
+        return false;
+    };
+
+    //
+    // Expiry
+    //
+
+    void timer_wheel::advance(uint64_t now) {
+        m_advancing = true;
+        unsigned level, slot;
+        uint64_t deadline;
+        while (next_expiration(level, slot, deadline) && deadline <= now) {
+            if (deadline > m_elapsed)
+                m_elapsed = deadline;
+
+            // take the whole slot, callbacks can then re-arm or cancel
+            // any of its timers without touching the bitmap
+            link& head = m_slots[level][slot];
+            link pending;
+            pending.next = head.next;
+            pending.prev = head.prev;
+            pending.next->prev = &pending;
+            pending.prev->next = &pending;
+            head.prev = head.next = &head;
+            m_occupied[level] &= ~(uint64_t(1) << slot);
+            for (link* i = pending.next; i != &pending; i = i->next)
+                static_cast<hook*>(i)->m_level = detached;
+
+            while (pending.next != &pending) {
+                hook& h = static_cast<hook&>(*pending.next);
+                if (h.m_expiry <= m_elapsed) {
+                    expire(h, now);
+                } else {
+                    // cascade down to a finer level
+                    unlink(h);
+                    insert(h, h.m_expiry);
+                }
+            }
+        }
+        if (now > m_elapsed)
+            m_elapsed = now;
+        m_advancing = false;
+    };
+
+    void timer_wheel::expire(hook& h, uint64_t now) {
+        unlink(h);
+        if (h.m_interval)
+            insert(h, now + h.m_interval);
+
+        m_running = &h;
+        h.on_expire();
+        // m_running is cleared if the callback destroyed the timer
+        if (m_running == &h && h.m_owned && !h.is_linked())
+            delete &h;
+        m_running = nullptr;
+    };
+
+    //
+    // uv_timer_t
+    //
+
+    void timer_wheel::arm() {
+        unsigned level, slot;
+        uint64_t deadline;
+        if (!next_expiration(level, slot, deadline)) {
+            if (m_armed) {
+                uv_timer_stop(&m_handle);
+                m_armed = false;
+            }
+            return;
+        }
+        if (m_armed && deadline == m_armed_deadline)
+            return;
+        uint64_t current = now();
+        uv_timer_start(&m_handle, on_timer, deadline > current ? deadline - current : 0, 0);
+        m_armed = true;
+        m_armed_deadline = deadline;
+    };
+
+    void timer_wheel::update_ref() {
+        bool referenced = m_refs != 0;
+        if (referenced == m_handle_ref)
+            return;
+        if (referenced)
+            uv_ref(reinterpret_cast<uv_handle_t*>(&m_handle));
+        else
+            uv_unref(reinterpret_cast<uv_handle_t*>(&m_handle));
+        m_handle_ref = referenced;
+    };
+}
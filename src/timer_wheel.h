@@ -0,0 +1,141 @@
+//
+//  timer_wheel.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__timer_wheel__
+#define __ngn__timer_wheel__
+
+#include <uv.h>
+#include <cstdint>
+
+namespace ngn {
+    //
+    // Hierarchical timing wheel behind every Timer of an isolate
+    //
+    // Six levels of 64 slots: level 0 has 1ms slots, every level above is
+    // 64 times coarser, covering a bit over two years in total. A timer is
+    // filed by its absolute expiry at the lowest level whose range still
+    // contains it, so insert and cancel are a list splice plus a bit flip
+    // in that level's occupancy bitmap. When a coarse slot comes due its
+    // timers cascade down to finer levels until they reach level 0 and fire.
+    //
+    // The next due slot is found from the bitmaps, which drives a single
+    // uv_timer_t, so libuv only ever sees one timer however many are armed.
+    // Not thread safe, like everything else on an isolate
+    //
+    class timer_wheel {
+        static const unsigned slot_bits = 6;
+        static const unsigned slot_count = 1 << slot_bits;
+        static const unsigned level_count = 6;
+        // anything further out parks in the last slot of the top level
+        static const uint64_t max_range = uint64_t(1) << (slot_bits * level_count);
+
+        struct link {
+            link* prev;
+            link* next;
+        };
+        static void on_timer(uv_timer_t* handle, int status);
+    public:
+        //
+        // Intrusive node, timers derive from it so arming never allocates
+        //
+        class hook : private link {
+            friend class timer_wheel;
+        public:
+            explicit hook(timer_wheel& wheel) noexcept;
+            hook(const hook&) = delete;
+            hook& operator=(const hook&) = delete;
+            virtual ~hook();
+
+            bool is_linked() const noexcept {
+                return next != nullptr;
+            };
+            // absolute expiry in loop time (ms)
+            uint64_t expiry() const noexcept {
+                return m_expiry;
+            };
+            // re-arm period in ms, 0 for one-shot timers
+            uint64_t interval() const noexcept {
+                return m_interval;
+            };
+            void interval(uint64_t interval) noexcept {
+                m_interval = interval;
+            };
+            timer_wheel& wheel() const noexcept {
+                return *m_wheel;
+            };
+        protected:
+            virtual void on_expire() = 0;
+            // the wheel deletes owned hooks after their last expiry or
+            // when they're cancelled
+            void wheel_owned(bool owned) noexcept {
+                m_owned = owned;
+            };
+        private:
+            timer_wheel* m_wheel;
+            uint64_t m_expiry;
+            uint64_t m_interval;
+            // slot the hook is filed under, detached while a slot is
+            // being processed
+            unsigned char m_level;
+            unsigned char m_slot;
+            bool m_ref;
+            bool m_owned;
+        };
+
+        explicit timer_wheel(uv_loop_t* loop);
+        timer_wheel(const timer_wheel&) = delete;
+        timer_wheel& operator=(const timer_wheel&) = delete;
+        ~timer_wheel();
+
+        // loop time in ms
+        uint64_t now() const {
+            return uv_now(m_loop);
+        };
+        size_t size() const {
+            return m_count;
+        };
+
+        // (re)arms h to fire in timeout ms, then every interval ms if non zero
+        void schedule(hook& h, uint64_t timeout, uint64_t interval);
+        // disarms h, owned hooks are freed unless they're firing right now
+        void cancel(hook& h);
+        // referenced timers keep the loop alive, like uv_ref/uv_unref
+        void ref(hook& h);
+        void unref(hook& h);
+
+        // closes the uv_timer_t, the loop has to run before deleting the wheel
+        void close();
+
+    private:
+        static const unsigned char detached = 0xff;
+
+        void insert(hook& h, uint64_t expiry);
+        void unlink(hook& h);
+        void expire(hook& h, uint64_t now);
+        bool next_expiration(unsigned& level, unsigned& slot, uint64_t& deadline) const;
+        void advance(uint64_t now);
+        void arm();
+        void update_ref();
+
+        uv_loop_t* m_loop;
+        uv_timer_t m_handle;
+        // time the wheel has been processed up to
+        uint64_t m_elapsed;
+        uint64_t m_occupied[level_count];
+        link m_slots[level_count][slot_count];
+        size_t m_count;
+        size_t m_refs;
+        // hook whose callback is running, cleared if it gets destroyed
+        hook* m_running;
+        uint64_t m_armed_deadline;
+        bool m_armed;
+        bool m_advancing;
+        bool m_handle_ref;
+    };
+}
+
+#endif /* defined(__ngn__timer_wheel__) */
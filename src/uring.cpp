@@ -0,0 +1,348 @@
+//
+//  uring.cpp
+//  ngn
+//
+//
+//
+
+#include "uring.h"
+#include "isolate.h"
+
+#if defined(NGN_USE_IO_URING) && defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace ngn {
+    const unsigned uring::default_entries;
+    const uring::size_type uring::fixed_buffer_size;
+
+#if defined(NGN_USE_IO_URING) && defined(__linux__)
+    // the iovecs are handed to the kernel as they are
+    static_assert(sizeof(uv_buf_t) == sizeof(struct iovec), "uv_buf_t isn't an iovec");
+
+    namespace {
+        // glibc has no wrappers for these
+        int io_uring_setup(unsigned entries, io_uring_params* params) {
+            return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+        }
+        int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+            return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+        }
+        int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+            return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+        }
+
+        // the kernel moves the other end of each ring
+        inline unsigned load_acquire(const unsigned* p) {
+            return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+        }
+        inline void store_release(unsigned* p, unsigned value) {
+            __atomic_store_n(p, value, __ATOMIC_RELEASE);
+        }
+
+        template <class T>
+        T* at(void* base, size_t offset) {
+            return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+        }
+    }
+
+    //
+    // Setup
+    //
+
+    uring* uring::create(isolate& isolate, unsigned entries) {
+        uring* ring = new uring(isolate);
+        if (!ring->setup(entries)) {
+            delete ring;
+            return nullptr;
+        }
+        // locked memory limits may refuse this, plain reads still work
+        ring->register_buffers(isolate.buffer_pool().pin(fixed_buffer_size));
+        return ring;
+    };
+
+    uring::uring(isolate& isolate) :
+        m_isolate(isolate),
+        m_fd(-1),
+        m_eventfd(-1),
+        m_features(0),
+        m_sq_ring(MAP_FAILED),
+        m_sq_ring_size(0),
+        m_sqes(nullptr),
+        m_sqes_size(0),
+        m_sq_pending_tail(0),
+        m_cq_ring(MAP_FAILED),
+        m_cq_ring_size(0),
+        m_in_flight(0),
+        m_flush_scheduled(false),
+        m_polling(false),
+        m_ref(false),
+        m_broken(false) {
+        m_poll.data = this;
+    };
+
+    uring::~uring() {
+        if (m_sqes != nullptr)
+            munmap(m_sqes, m_sqes_size);
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+            munmap(m_cq_ring, m_cq_ring_size);
+        if (m_sq_ring != MAP_FAILED)
+            munmap(m_sq_ring, m_sq_ring_size);
+        if (m_eventfd >= 0)
+            ::close(m_eventfd);
+        // closing the ring cancels whatever is still in flight
+        if (m_fd >= 0)
+            ::close(m_fd);
+    };
+
+    bool uring::setup(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        m_fd = io_uring_setup(entries, &params);
+        if (m_fd < 0)
+            return false;
+        m_features = params.features;
+
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (m_features & IORING_FEAT_SINGLE_MMAP)
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if (m_sq_ring == MAP_FAILED)
+            return false;
+        if (m_features & IORING_FEAT_SINGLE_MMAP) {
+            m_cq_ring = m_sq_ring;
+        } else {
+            m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+            if (m_cq_ring == MAP_FAILED)
+                return false;
+        }
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return false;
+        m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+        m_sq_head = at<unsigned>(m_sq_ring, params.sq_off.head);
+        m_sq_tail = at<unsigned>(m_sq_ring, params.sq_off.tail);
+        m_sq_array = at<unsigned>(m_sq_ring, params.sq_off.array);
+        m_sq_mask = *at<unsigned>(m_sq_ring, params.sq_off.ring_mask);
+        m_sq_entries = params.sq_entries;
+        m_sq_pending_tail = *m_sq_tail;
+        m_cq_head = at<unsigned>(m_cq_ring, params.cq_off.head);
+        m_cq_tail = at<unsigned>(m_cq_ring, params.cq_off.tail);
+        m_cqes = at<io_uring_cqe>(m_cq_ring, params.cq_off.cqes);
+        m_cq_mask = *at<unsigned>(m_cq_ring, params.cq_off.ring_mask);
+        m_cq_entries = params.cq_entries;
+
+        // completions wake the loop through the eventfd (5.2+)
+        m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_eventfd < 0)
+            return false;
+        if (io_uring_register(m_fd, IORING_REGISTER_EVENTFD, &m_eventfd, 1) < 0)
+            return false;
+        if (uv_poll_init(m_isolate.event_loop().handle(), &m_poll, m_eventfd) < 0)
+            return false;
+        m_polling = true;
+        uv_poll_start(&m_poll, UV_READABLE, on_poll);
+        // only requests in flight keep the loop alive
+        uv_unref(reinterpret_cast<uv_handle_t*>(&m_poll));
+        return true;
+    };
+
+    void uring::register_buffers(const std::vector<uv_buf_t>& buffers) {
+        if (buffers.empty())
+            return;
+        if (io_uring_register(m_fd, IORING_REGISTER_BUFFERS, buffers.data(),
+                              static_cast<unsigned>(buffers.size())) == 0)
+            m_fixed = buffers;
+    };
+
+    void uring::close() {
+        if (m_polling)
+            uv_close(reinterpret_cast<uv_handle_t*>(&m_poll), nullptr);
+        m_polling = false;
+    };
+
+    //
+    // Submission
+    //
+
+    bool uring::readv(int fd, const uv_buf_t* bufs, unsigned nbufs, int64_t offset, request* req) {
+        return push(IORING_OP_READV, fd, bufs, nbufs, offset, req);
+    };
+
+    bool uring::writev(int fd, const uv_buf_t* bufs, unsigned nbufs, int64_t offset, request* req) {
+        return push(IORING_OP_WRITEV, fd, bufs, nbufs, offset, req);
+    };
+
+    bool uring::push(uint8_t opcode, int fd, const uv_buf_t* bufs, unsigned nbufs, int64_t offset, request* req) {
+        if (m_broken || !m_polling || nbufs == 0)
+            return false;
+        // the descriptor's position needs 5.6
+        if (offset < 0 && !(m_features & IORING_FEAT_RW_CUR_POS))
+            return false;
+        // never have more in flight than the completion ring can hold
+        if (m_in_flight >= m_cq_entries)
+            return false;
+        if (m_sq_pending_tail - load_acquire(m_sq_head) >= m_sq_entries) {
+            flush();
+            if (m_broken || m_sq_pending_tail - load_acquire(m_sq_head) >= m_sq_entries)
+                return false;
+        }
+
+        unsigned index = m_sq_pending_tail & m_sq_mask;
+        io_uring_sqe& sqe = m_sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.fd = fd;
+        sqe.off = offset < 0 ? static_cast<uint64_t>(-1) : static_cast<uint64_t>(offset);
+        sqe.user_data = reinterpret_cast<uint64_t>(req);
+        int fixed = nbufs == 1 ? fixed_index(bufs[0]) : -1;
+        if (fixed >= 0) {
+            sqe.opcode = opcode == IORING_OP_READV ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe.addr = reinterpret_cast<uint64_t>(bufs[0].base);
+            sqe.len = static_cast<uint32_t>(bufs[0].len);
+            sqe.buf_index = static_cast<uint16_t>(fixed);
+        } else {
+            sqe.opcode = opcode;
+            sqe.addr = reinterpret_cast<uint64_t>(bufs);
+            sqe.len = nbufs;
+        }
+        m_sq_array[index] = index;
+        ++m_sq_pending_tail;
+        ++m_in_flight;
+        update_ref();
+        schedule_flush();
+        return true;
+    };
+
+    int uring::fixed_index(const uv_buf_t& buf) const {
+        for (size_t i = 0; i < m_fixed.size(); ++i) {
+            const uv_buf_t& fixed = m_fixed[i];
+            if (buf.base >= fixed.base && buf.base + buf.len <= fixed.base + fixed.len)
+                return static_cast<int>(i);
+        }
+        return -1;
+    };
+
+    void uring::schedule_flush() {
+        if (m_flush_scheduled)
+            return;
+        m_flush_scheduled = true;
+        m_isolate.event_loop().nextTick([this] {
+            m_flush_scheduled = false;
+            flush();
+        });
+    };
+
+    void uring::flush() {
+        unsigned queued = m_sq_pending_tail - load_acquire(m_sq_head);
+        if (queued == 0 || m_broken)
+            return;
+        store_release(m_sq_tail, m_sq_pending_tail);
+        int result = io_uring_enter(m_fd, queued, 0, 0);
+        if (result < 0 && errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+            fail_queued(-errno);
+            return;
+        }
+        // the kernel is short on memory or completions, try again next tick
+        if (m_sq_pending_tail != load_acquire(m_sq_head))
+            schedule_flush();
+    };
+
+    void uring::fail_queued(int status) {
+        // without SQPOLL the kernel only takes entries in io_uring_enter(),
+        // which won't be called again
+        m_broken = true;
+        unsigned head = load_acquire(m_sq_head);
+        std::vector<request*> failed;
+        for (; head != m_sq_pending_tail; ++head)
+            failed.push_back(reinterpret_cast<request*>(m_sqes[m_sq_array[head & m_sq_mask]].user_data));
+        m_in_flight -= failed.size();
+        update_ref();
+        // this can be reached from push(), callers expect their callbacks
+        // after the call that submitted them has returned
+        m_isolate.event_loop().nextTick([failed, status] {
+            for (auto req : failed)
+                req->on_complete(req, status);
+        });
+    };
+
+    //
+    // Completion
+    //
+
+    void uring::on_poll(uv_poll_t* handle, int status, int events) {
+        auto ring = static_cast<uring*>(handle->data);
+        uint64_t count;
+        // clears the eventfd, every completion is in the ring anyway
+        while (::read(ring->m_eventfd, &count, sizeof(count)) > 0) {}
+        ring->reap();
+    };
+
+    void uring::reap() {
+        unsigned head = *m_cq_head;
+        unsigned tail;
+        while (head != (tail = load_acquire(m_cq_tail))) {
+            for (; head != tail; ++head) {
+                const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+                auto req = reinterpret_cast<request*>(cqe.user_data);
+                ssize_t result = cqe.res;
+                // hand the slot back before the callback queues more
+                store_release(m_cq_head, head + 1);
+                --m_in_flight;
+                req->on_complete(req, result);
+            }
+        }
+        update_ref();
+    };
+
+    void uring::update_ref() {
+        bool referenced = m_in_flight != 0;
+        if (referenced == m_ref || !m_polling)
+            return;
+        if (referenced)
+            uv_ref(reinterpret_cast<uv_handle_t*>(&m_poll));
+        else
+            uv_unref(reinterpret_cast<uv_handle_t*>(&m_poll));
+        m_ref = referenced;
+    };
+#else
+    //
+    // Stubs
+    //
+    // no ring is ever created, callers stay on uv_fs_*
+
+    uring* uring::create(isolate& isolate, unsigned entries) {
+        return nullptr;
+    };
+
+    uring::~uring() {
+    };
+
+    bool uring::readv(int fd, const uv_buf_t* bufs, unsigned nbufs, int64_t offset, request* req) {
+        return false;
+    };
+
+    bool uring::writev(int fd, const uv_buf_t* bufs, unsigned nbufs, int64_t offset, request* req) {
+        return false;
+    };
+
+    void uring::flush() {
+    };
+
+    void uring::close() {
+    };
+#endif
+}
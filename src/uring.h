@@ -0,0 +1,127 @@
+//
+//  uring.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__uring__
+#define __ngn__uring__
+
+#include <uv.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace ngn {
+    class isolate;
+
+    //
+    // io_uring file engine (Linux 5.2+, builds with NGN_USE_IO_URING)
+    //
+    // File reads and writes go straight to the kernel instead of hopping
+    // through libuv's threadpool. Requests queued during a tick are
+    // submitted together with one io_uring_enter() when the tick ends,
+    // and completions are signalled on an eventfd that the isolate's loop
+    // polls, so callbacks run on the loop thread like any other.
+    //
+    // The pool's 64KB size class is registered with the kernel at start,
+    // a single buffer inside it is read or written with the _FIXED ops
+    // which skip mapping the pages in on every call.
+    //
+    // Anything the ring can't take (it's full, the kernel is missing a
+    // feature, or the build has no io_uring) is refused, and the caller
+    // goes through uv_fs_* instead
+    //
+    class uring {
+        static void on_poll(uv_poll_t* handle, int status, int events);
+    public:
+        typedef size_t size_type;
+
+        // submitted operations derive from this, on_complete gets the
+        // byte count or a negative libuv error code
+        struct request {
+            void (*on_complete)(request* req, ssize_t result);
+        };
+
+        static const unsigned default_entries = 256;
+        // pool size class registered for fixed reads and writes
+        static const size_type fixed_buffer_size = 64 * 1024;
+
+        // nullptr when the build or the kernel can't give us a ring
+        static uring* create(isolate& isolate, unsigned entries = default_entries);
+        uring(const uring&) = delete;
+        uring& operator=(const uring&) = delete;
+        ~uring();
+
+        //
+        // Submission
+        //
+        // offset -1 uses the descriptor's position. bufs has to stay valid
+        // until req completes, older kernels read it after submission.
+        // Returns false if the request wasn't queued
+        bool readv(int fd, const uv_buf_t* bufs, unsigned nbufs, int64_t offset, request* req);
+        bool writev(int fd, const uv_buf_t* bufs, unsigned nbufs, int64_t offset, request* req);
+        // submits everything queued so far, normally done at the end of the tick
+        void flush();
+
+        // stops polling, has to go through the loop before the ring is deleted
+        void close();
+
+    private:
+        explicit uring(isolate& isolate);
+        bool setup(unsigned entries);
+        void register_buffers(const std::vector<uv_buf_t>& buffers);
+        bool push(uint8_t opcode, int fd, const uv_buf_t* bufs, unsigned nbufs, int64_t offset, request* req);
+        // index of the registered buffer holding buf, or -1
+        int fixed_index(const uv_buf_t& buf) const;
+        void schedule_flush();
+        // fails everything that is queued but wasn't submitted
+        void fail_queued(int status);
+        void reap();
+        void update_ref();
+
+        isolate& m_isolate;
+        int m_fd;
+        int m_eventfd;
+        uv_poll_t m_poll;
+        unsigned m_features;
+
+        // submission ring
+        void* m_sq_ring;
+        size_t m_sq_ring_size;
+        unsigned* m_sq_head;
+        unsigned* m_sq_tail;
+        unsigned* m_sq_array;
+        unsigned m_sq_mask;
+        unsigned m_sq_entries;
+        io_uring_sqe* m_sqes;
+        size_t m_sqes_size;
+        // entries filled in but not handed to the kernel yet
+        unsigned m_sq_pending_tail;
+
+        // completion ring, may share the submission ring's mapping
+        void* m_cq_ring;
+        size_t m_cq_ring_size;
+        unsigned* m_cq_head;
+        unsigned* m_cq_tail;
+        io_uring_cqe* m_cqes;
+        unsigned m_cq_mask;
+        unsigned m_cq_entries;
+
+        std::vector<uv_buf_t> m_fixed;
+        // queued or submitted, not completed
+        size_type m_in_flight;
+        bool m_flush_scheduled;
+        bool m_polling;
+        bool m_ref;
+        // io_uring_enter() failed for good, everything goes to libuv
+        bool m_broken;
+    };
+}
+
+#endif /* defined(__ngn__uring__) */
@@ -0,0 +1,451 @@
+//
+//  utf8.cpp
+//  ngn
+//
+//
+//
+
+#include "utf8.h"
+#include "ascii.h"
+#include "cpu_features.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(NGN_HAVE_X86_DISPATCH)
+#include <immintrin.h>
+#endif
+
+namespace ngn {
+    namespace {
+        const uint32_t replacement_character = 0xFFFD;
+
+        // Decodes one code point and advances s. On malformed input s is
+        // left after the maximal invalid subpart and false is returned
+        inline bool decode_one(const uint8_t*& s, const uint8_t* end, uint32_t& cp) noexcept {
+            const uint8_t lead = *s++;
+            if (lead < 0x80) {
+                cp = lead;
+                return true;
+            }
+
+            unsigned need;
+            uint8_t lo = 0x80;
+            uint8_t hi = 0xBF;
+            if (lead >= 0xC2 && lead <= 0xDF) {
+                need = 1;
+                cp = lead & 0x1F;
+            } else if (lead >= 0xE0 && lead <= 0xEF) {
+                need = 2;
+                cp = lead & 0x0F;
+                if (lead == 0xE0)
+                    lo = 0xA0;
+                else if (lead == 0xED)
+                    hi = 0x9F;
+            } else if (lead >= 0xF0 && lead <= 0xF4) {
+                need = 3;
+                cp = lead & 0x07;
+                if (lead == 0xF0)
+                    lo = 0x90;
+                else if (lead == 0xF4)
+                    hi = 0x8F;
+            } else {
+                return false;
+            }
+
+            for (; need > 0; --need) {
+                if (s == end || *s < lo || *s > hi)
+                    return false;
+                cp = (cp << 6) | (*s++ & 0x3F);
+                lo = 0x80;
+                hi = 0xBF;
+            }
+            return true;
+        }
+
+        inline bool is_ascii_word(const uint8_t* s) noexcept {
+            uint64_t word;
+            memcpy(&word, s, sizeof(word));
+            return (word & 0x8080808080808080ull) == 0;
+        }
+
+        //
+        // Validation kernels
+        //
+
+        bool validate_scalar(const uint8_t* s, size_t len) noexcept {
+            const uint8_t* end = s + len;
+            while (s < end) {
+                if (end - s >= 8 && is_ascii_word(s)) {
+                    s += 8;
+                    continue;
+                }
+                uint32_t cp;
+                if (!decode_one(s, end, cp))
+                    return false;
+            }
+            return true;
+        }
+
+#if defined(NGN_HAVE_X86_DISPATCH)
+        // Lookup based validation from Keiser & Lemire, "Validating UTF-8 In
+        // Less Than One Instruction Per Byte" (the simdjson validator). Each
+        // byte pair is classified by three nibble lookups; a pair is bad when
+        // the classes share a bit. Continuation bytes required by a 3 or 4
+        // byte lead further back are checked separately
+        const uint8_t TOO_SHORT = 1 << 0;   // 11______ 0_______ / 11______ 11______
+        const uint8_t TOO_LONG = 1 << 1;    // 0_______ 10______
+        const uint8_t OVERLONG_3 = 1 << 2;  // 11100000 100_____
+        const uint8_t TOO_LARGE = 1 << 3;   // 11110100 1001____ / 11110100 101_____
+        const uint8_t SURROGATE = 1 << 4;   // 11101101 101_____
+        const uint8_t OVERLONG_2 = 1 << 5;  // 1100000_ 10______
+        const uint8_t TOO_LARGE_1000 = 1 << 6; // 11110101+ 1000____
+        const uint8_t OVERLONG_4 = 1 << 6;  // 11110000 1000____
+        const uint8_t TWO_CONTS = 1 << 7;   // 10______ 10______
+        const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+        const uint8_t byte_1_high[16] = {
+            // 0_______ ________
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            // 10______ ________
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            // 1100____ ________
+            TOO_SHORT | OVERLONG_2,
+            // 1101____ ________
+            TOO_SHORT,
+            // 1110____ ________
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            // 1111____ ________
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+        };
+
+        const uint8_t byte_1_low[16] = {
+            // ____0000 ________
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+            // ____0001 ________
+            CARRY | OVERLONG_2,
+            // ____001_ ________
+            CARRY,
+            CARRY,
+            // ____0100 ________
+            CARRY | TOO_LARGE,
+            // ____0101 ________ and up
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            // ____1101 ________
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000
+        };
+
+        const uint8_t byte_2_high[16] = {
+            // ________ 0_______
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            // ________ 1000____
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+            // ________ 1001____
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            // ________ 101_____
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            // ________ 11______
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+        };
+
+        // a lead byte in the last 3 positions still waiting for continuations
+        const uint8_t incomplete_max[32] = {
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+            0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+        };
+
+        //
+        // SSE4.1
+        //
+
+        NGN_TARGET("sse4.1")
+        inline __m128i load_lut(const uint8_t* lut) {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(lut));
+        }
+
+        NGN_TARGET("sse4.1")
+        inline __m128i check_block(__m128i in, __m128i prev_in) {
+            const __m128i nibble = _mm_set1_epi8(0x0f);
+            const __m128i prev1 = _mm_alignr_epi8(in, prev_in, 15);
+            const __m128i prev2 = _mm_alignr_epi8(in, prev_in, 14);
+            const __m128i prev3 = _mm_alignr_epi8(in, prev_in, 13);
+
+            __m128i special = _mm_shuffle_epi8(load_lut(byte_1_high), _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+            special = _mm_and_si128(special, _mm_shuffle_epi8(load_lut(byte_1_low), _mm_and_si128(prev1, nibble)));
+            special = _mm_and_si128(special, _mm_shuffle_epi8(load_lut(byte_2_high), _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+            const __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xE0 - 0x80)));
+            const __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xF0 - 0x80)));
+            const __m128i must_be_continuation = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(char(0x80)));
+            return _mm_xor_si128(must_be_continuation, special);
+        }
+
+        NGN_TARGET("sse4.1")
+        bool validate_sse41(const uint8_t* s, size_t len) noexcept {
+            const __m128i max = _mm_loadu_si128(reinterpret_cast<const __m128i*>(incomplete_max + 16));
+            __m128i error = _mm_setzero_si128();
+            __m128i prev_in = _mm_setzero_si128();
+            __m128i prev_incomplete = _mm_setzero_si128();
+
+            size_t i = 0;
+            for (; i + 16 <= len; i += 16) {
+                const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+                if (_mm_movemask_epi8(in) == 0) {
+                    error = _mm_or_si128(error, prev_incomplete);
+                } else {
+                    error = _mm_or_si128(error, check_block(in, prev_in));
+                    prev_incomplete = _mm_subs_epu8(in, max);
+                }
+                prev_in = in;
+            }
+
+            // the zero padding also flags a sequence cut off by the end
+            uint8_t tail[16] = {};
+            memcpy(tail, s + i, len - i);
+            error = _mm_or_si128(error, check_block(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)), prev_in));
+            return _mm_testz_si128(error, error);
+        }
+
+        //
+        // AVX2
+        //
+
+        NGN_TARGET("avx2")
+        inline __m256i load_lut256(const uint8_t* lut) {
+            return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lut)));
+        }
+
+        NGN_TARGET("avx2")
+        inline __m256i check_block(__m256i in, __m256i prev_in) {
+            const __m256i nibble = _mm256_set1_epi8(0x0f);
+            // alignr works within 128 bit lanes, splice in the previous lane first
+            const __m256i shifted = _mm256_permute2x128_si256(prev_in, in, 0x21);
+            const __m256i prev1 = _mm256_alignr_epi8(in, shifted, 15);
+            const __m256i prev2 = _mm256_alignr_epi8(in, shifted, 14);
+            const __m256i prev3 = _mm256_alignr_epi8(in, shifted, 13);
+
+            __m256i special = _mm256_shuffle_epi8(load_lut256(byte_1_high), _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+            special = _mm256_and_si256(special, _mm256_shuffle_epi8(load_lut256(byte_1_low), _mm256_and_si256(prev1, nibble)));
+            special = _mm256_and_si256(special, _mm256_shuffle_epi8(load_lut256(byte_2_high), _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+
+            const __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xE0 - 0x80)));
+            const __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xF0 - 0x80)));
+            const __m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(char(0x80)));
+            return _mm256_xor_si256(must_be_continuation, special);
+        }
+
+        NGN_TARGET("avx2")
+        bool validate_avx2(const uint8_t* s, size_t len) noexcept {
+            const __m256i max = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(incomplete_max));
+            __m256i error = _mm256_setzero_si256();
+            __m256i prev_in = _mm256_setzero_si256();
+            __m256i prev_incomplete = _mm256_setzero_si256();
+
+            size_t i = 0;
+            for (; i + 32 <= len; i += 32) {
+                const __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+                if (_mm256_movemask_epi8(in) == 0) {
+                    error = _mm256_or_si256(error, prev_incomplete);
+                } else {
+                    error = _mm256_or_si256(error, check_block(in, prev_in));
+                    prev_incomplete = _mm256_subs_epu8(in, max);
+                }
+                prev_in = in;
+            }
+
+            uint8_t tail[32] = {};
+            memcpy(tail, s + i, len - i);
+            error = _mm256_or_si256(error, check_block(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail)), prev_in));
+            return _mm256_testz_si256(error, error);
+        }
+#endif
+
+        typedef bool (*validate_fn)(const uint8_t*, size_t);
+
+        validate_fn select_validate() noexcept {
+#if defined(NGN_HAVE_X86_DISPATCH)
+            const cpu::features& cpu = cpu::detect();
+            if (cpu.avx2)
+                return validate_avx2;
+            if (cpu.sse41)
+                return validate_sse41;
+#endif
+            return validate_scalar;
+        }
+
+        validate_fn validate_kernel() noexcept {
+            static const validate_fn selected = select_validate();
+            return selected;
+        }
+
+        inline size_t utf8_width(uint32_t cp) noexcept {
+            return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+        }
+    }
+
+
+    bool utf8_validate(const char* src, size_t len) noexcept {
+        // nothing before the first non-ascii byte can be malformed
+        const size_t ascii = find_non_ascii(src, len);
+        if (ascii == len)
+            return true;
+        return validate_kernel()(reinterpret_cast<const uint8_t*>(src + ascii), len - ascii);
+    };
+
+
+    size_t utf16_length_from_utf8(const char* src, size_t len) noexcept {
+        const size_t ascii = find_non_ascii(src, len);
+        if (ascii == len)
+            return len;
+
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(src) + ascii;
+        const uint8_t* end = reinterpret_cast<const uint8_t*>(src) + len;
+        size_t count = ascii;
+
+        if (validate_kernel()(s, end - s)) {
+            // every lead byte starts a unit, 4 byte sequences need a pair
+            for (; s < end; ++s)
+                count += ((*s & 0xC0) != 0x80) + (*s >= 0xF0);
+            return count;
+        }
+
+        while (s < end) {
+            uint32_t cp;
+            count += decode_one(s, end, cp) && cp >= 0x10000 ? 2 : 1;
+        }
+        return count;
+    };
+
+
+    size_t utf8_length_from_utf16(const char16_t* src, size_t len) noexcept {
+        size_t count = 0;
+        for (size_t i = 0; i < len; ++i) {
+            const uint32_t unit = src[i];
+            if (unit < 0x80) {
+                count += 1;
+            } else if (unit < 0x800) {
+                count += 2;
+            } else if (unit >= 0xD800 && unit <= 0xDBFF && i + 1 < len &&
+                       src[i + 1] >= 0xDC00 && src[i + 1] <= 0xDFFF) {
+                count += 4;
+                ++i;
+            } else {
+                // BMP character or U+FFFD for a lone surrogate
+                count += 3;
+            }
+        }
+        return count;
+    };
+
+
+    size_t utf8_to_utf16(const char* src,
+                         size_t len,
+                         char16_t* dst,
+                         size_t dlen,
+                         size_t* read) noexcept {
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+        const uint8_t* end = s + len;
+        char16_t* out = dst;
+        char16_t* out_end = dst + dlen;
+
+        while (s < end && out < out_end) {
+            if (end - s >= 8 && out_end - out >= 8 && is_ascii_word(s)) {
+                for (unsigned i = 0; i < 8; ++i)
+                    out[i] = s[i];
+                s += 8;
+                out += 8;
+                continue;
+            }
+
+            const uint8_t* start = s;
+            uint32_t cp;
+            if (!decode_one(s, end, cp))
+                cp = replacement_character;
+
+            if (cp >= 0x10000) {
+                if (out_end - out < 2) {
+                    s = start;
+                    break;
+                }
+                cp -= 0x10000;
+                *out++ = 0xD800 + (cp >> 10);
+                *out++ = 0xDC00 + (cp & 0x3FF);
+            } else {
+                *out++ = cp;
+            }
+        }
+
+        if (read != nullptr)
+            *read = s - reinterpret_cast<const uint8_t*>(src);
+        return out - dst;
+    };
+
+
+    size_t utf16_to_utf8(const char16_t* src,
+                         size_t len,
+                         char* dst,
+                         size_t dlen,
+                         size_t* read) noexcept {
+        size_t i = 0;
+        uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+        uint8_t* out_end = out + dlen;
+
+        while (i < len && out < out_end) {
+            uint32_t cp = src[i];
+            size_t units = 1;
+            if (cp >= 0xD800 && cp <= 0xDFFF) {
+                if (cp <= 0xDBFF && i + 1 < len && src[i + 1] >= 0xDC00 && src[i + 1] <= 0xDFFF) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (src[i + 1] - 0xDC00);
+                    units = 2;
+                } else {
+                    cp = replacement_character;
+                }
+            }
+
+            const size_t width = utf8_width(cp);
+            if (static_cast<size_t>(out_end - out) < width)
+                break;
+
+            switch (width) {
+                case 1:
+                    out[0] = cp;
+                    break;
+                case 2:
+                    out[0] = 0xC0 | (cp >> 6);
+                    out[1] = 0x80 | (cp & 0x3F);
+                    break;
+                case 3:
+                    out[0] = 0xE0 | (cp >> 12);
+                    out[1] = 0x80 | ((cp >> 6) & 0x3F);
+                    out[2] = 0x80 | (cp & 0x3F);
+                    break;
+                default:
+                    out[0] = 0xF0 | (cp >> 18);
+                    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+                    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+                    out[3] = 0x80 | (cp & 0x3F);
+                    break;
+            }
+            out += width;
+            i += units;
+        }
+
+        if (read != nullptr)
+            *read = i;
+        return out - reinterpret_cast<uint8_t*>(dst);
+    };
+}
@@ -0,0 +1,41 @@
+//
+//  utf8.h
+//  ngn
+//
+//
+//
+
+#ifndef __ngn__utf8__
+#define __ngn__utf8__
+
+#include <cstddef>
+
+namespace ngn {
+    // true if src is well formed UTF-8: no overlong forms, surrogates,
+    // code points above U+10FFFF or truncated sequences
+    bool utf8_validate(const char* src, size_t len) noexcept;
+
+    // exact number of UTF-16 code units utf8_to_utf16 produces for src
+    size_t utf16_length_from_utf8(const char* src, size_t len) noexcept;
+
+    // exact number of bytes utf16_to_utf8 produces for src
+    size_t utf8_length_from_utf16(const char16_t* src, size_t len) noexcept;
+
+    // Transcoders. Malformed input becomes U+FFFD (one per maximal invalid
+    // subpart, like browsers do), output stops before a character that
+    // doesn't fit so nothing is ever split. Return the number of code units
+    // written; read, when given, gets the number of code units consumed
+    size_t utf8_to_utf16(const char* src,
+                         size_t len,
+                         char16_t* dst,
+                         size_t dlen,
+                         size_t* read = nullptr) noexcept;
+
+    size_t utf16_to_utf8(const char16_t* src,
+                         size_t len,
+                         char* dst,
+                         size_t dlen,
+                         size_t* read = nullptr) noexcept;
+}
+
+#endif /* defined(__ngn__utf8__) */